@@ -0,0 +1,19 @@
+#!/usr/bin/env bash
+# Running a large file: reading its source, against decoding the forms
+# cached from an earlier run, as reported by -d
+# usage: bench/cache.sh [MB] (from the repo root, with ./blisp built)
+MB=${1:-50}
+BLISP=${BLISP:-./blisp}
+DIR=/tmp/blisp_cache
+
+# small top-level forms, mostly quoted data so evaluating them is cheap
+row='(len {(a b c) {d 12345} -42 (e (f (g h))) xs 7})'
+yes "$row" | head -c $((MB * 1024 * 1024)) | sed '$d' > /tmp/blisp_cache.blisp
+rm -rf "$DIR"
+
+run() { "$BLISP" -d "$@" run /tmp/blisp_cache.blisp 2>&1 > /dev/null | grep '^cache \(hit\|miss\)\|^loaded'; }
+echo "no cache:";   run
+echo "first run:";  run --cache "$DIR"
+echo "second run:"; run --cache "$DIR"
+ls -l /tmp/blisp_cache.blisp "$DIR"
+rm -rf /tmp/blisp_cache.blisp "$DIR"
@@ -0,0 +1,49 @@
+/* N contexts on N threads, each evaluating the same workload */
+/* cc --std=c99 -O2 -pthread -DBLISP_NO_MAIN -I. bench/contexts.c blisp.c mpc.c -lreadline -lm -o contexts */
+/* ./contexts [max threads] [evals per thread] */
+
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "blisp.h"
+
+int evals = 200;
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void* run(void* arg) {
+  blisp_ctx* ctx = blisp_ctx_new();
+  free(blisp_eval(ctx, "def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})"));
+  for (int i = 0; i < evals; i++) {
+    char* out = blisp_eval(ctx, "fib 15");
+    if (strcmp(out, "610") != 0) { fprintf(stderr, "bad result: %s\n", out); exit(1); }
+    free(out);
+  }
+  blisp_ctx_free(ctx);
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  int max = argc > 1 ? atoi(argv[1]) : 16;
+  if (argc > 2) { evals = atoi(argv[2]); }
+
+  double base = 0;
+  for (int n = 1; n <= max; n *= 2) {
+    pthread_t ids[n];
+    double start = now();
+    for (int i = 0; i < n; i++) { pthread_create(&ids[i], NULL, run, NULL); }
+    for (int i = 0; i < n; i++) { pthread_join(ids[i], NULL); }
+    double rate = n * evals / (now() - start);
+    if (n == 1) { base = rate; }
+    printf("%2d contexts: %8.0f evals/s (%.2fx)\n", n, rate, rate / base);
+  }
+  return 0;
+}
@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+# Validation-style input where most lines are rejected by their first
+# argument, ahead of arguments that are expensive to evaluate
+# usage: bench/errors.sh [lines] (from the repo root, with ./blisp built)
+N=${1:-2000}
+BLISP=${BLISP:-./blisp}
+
+{
+  echo '(def {fib} (\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))'
+  for ((i = 0; i < N; i++)); do
+    if ((i % 10)); then echo "(+ (head {}) (fib 12) $i)"; else echo "(+ (fib 12) $i)"; fi
+  done
+} > /tmp/blisp_errors.in
+
+time "$BLISP" < /tmp/blisp_errors.in > /dev/null
+rm -f /tmp/blisp_errors.in
@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+# Recursive fib through user-defined functions
+# usage: bench/fib.sh [n] (from the repo root, with ./blisp built)
+N=${1:-25}
+BLISP=${BLISP:-./blisp}
+
+printf '(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))\n' > /tmp/blisp_fib.in
+printf '(fib %s)\n' "$N" >> /tmp/blisp_fib.in
+
+time "$BLISP" < /tmp/blisp_fib.in > /dev/null
+rm -f /tmp/blisp_fib.in
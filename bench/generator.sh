@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+# Context switch cost: summing n numbers yielded by a generator, against
+# the same loop straight over the range. Each element is two switches
+# usage: bench/generator.sh [n] (from the repo root, with ./blisp built)
+N=${1:-1000000}
+BLISP=${BLISP:-./blisp}
+
+cat > /tmp/blisp_range.in <<END
+(reduce + 0 (map (\\ {x} {+ x 0}) (range $N)))
+END
+cat > /tmp/blisp_gen.in <<END
+(reduce + 0 (gen (\\ {} {reduce (\\ {_ x} {yield x}) () (range $N)})))
+END
+
+run() {
+  local start=$(date +%s%N)
+  "$BLISP" < "$1" > /dev/null
+  echo $(( $(date +%s%N) - start ))
+}
+
+RANGE=$(run /tmp/blisp_range.in)
+GEN=$(run /tmp/blisp_gen.in)
+echo "range:     $(( RANGE / 1000000 )) ms"
+echo "generator: $(( GEN / 1000000 )) ms"
+echo "per switch: $(( (GEN - RANGE) / (2 * N) )) ns"
+rm -f /tmp/blisp_range.in /tmp/blisp_gen.in
@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+# Startup with a large prelude: evaluating its source on every run,
+# against loading an image saved from it once
+# usage: bench/image.sh [definitions] [runs] (from the repo root, with ./blisp built)
+N=${1:-2000}
+RUNS=${2:-20}
+BLISP=${BLISP:-./blisp}
+
+for ((i = 0; i < N; i++)); do
+  echo "(def {f$i} (\\ {x y} {if (< x y) {+ x $i} {* (- x y) $i}}))"
+  echo "(def {t$i} {$i (a b c) {d $i} $((i * 7)) (f$i 1 2)})"
+done > /tmp/blisp_prelude.blisp
+echo '(f7 3 1)' > /tmp/blisp_main.blisp
+"$BLISP" --save-image /tmp/blisp_prelude.img run /tmp/blisp_prelude.blisp > /dev/null
+ls -l /tmp/blisp_prelude.blisp /tmp/blisp_prelude.img
+
+ms() {
+  local start=$(date +%s%N)
+  for ((r = 0; r < RUNS; r++)); do "$@" > /dev/null; done
+  echo $(( ($(date +%s%N) - start) / 1000000 / RUNS ))
+}
+
+echo "empty:   $(ms "$BLISP" run /tmp/blisp_main.blisp) ms per run"
+echo "source:  $(ms sh -c "cat /tmp/blisp_prelude.blisp /tmp/blisp_main.blisp | $BLISP -") ms per run"
+echo "image:   $(ms "$BLISP" --load-image /tmp/blisp_prelude.img run /tmp/blisp_main.blisp) ms per run"
+rm -f /tmp/blisp_prelude.blisp /tmp/blisp_main.blisp /tmp/blisp_prelude.img
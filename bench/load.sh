@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+# Loading a large file, mapped by blisp run FILE against read(2) from a
+# pipe, with the page cache dropped first (cold) and then warm. Times are
+# the loading -d reports: finding, reading and parsing the forms, not
+# evaluating them. Dropping the cache needs root; otherwise the cold runs
+# fall back on dd's nocache flag, which the kernel may ignore
+# usage: bench/load.sh [megabytes] (from the repo root, with ./blisp built)
+MB=${1:-100}
+BLISP=${BLISP:-./blisp}
+FILE=/tmp/blisp_load.blisp
+
+# forms of about 100 kB
+ITEM='alpha beta (gamma 12 -345) {delta 6789} epsilon_1 + <= '
+FORM="(len {$(yes "$ITEM" | head -n 1800 | tr -d '\n')})"
+yes "$FORM" | head -n $(( MB * 1048576 / (${#FORM} + 1) )) > "$FILE"
+
+drop() {
+  sync
+  echo 3 2>/dev/null > /proc/sys/vm/drop_caches ||
+    dd if="$FILE" iflag=nocache count=0 status=none
+}
+
+loaded() { "$@" -d 2>&1 >/dev/null | awk '/^loaded/ { print $(NF-1) }'; }
+mapped() { loaded "$BLISP" run "$FILE"; }
+piped() { cat "$FILE" | loaded "$BLISP" -; }
+
+echo "$(( $(stat -c %s "$FILE") / 1048576 )) MB"
+for how in mapped piped; do
+  drop
+  cold=$($how)
+  warm=$($how)
+  echo "$how: cold $cold ms, warm $warm ms"
+done
+rm -f "$FILE"
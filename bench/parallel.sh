@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+# Parallel evaluation of independent args at 1-16 threads
+# usage: bench/parallel.sh [n] (from the repo root, with ./blisp built)
+N=${1:-22}
+BLISP=${BLISP:-./blisp}
+
+cat > /tmp/blisp_parallel.in <<END
+(def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))
+(+ (fib $N) (fib $N) (fib $N) (fib $N) (fib $N) (fib $N) (fib $N) (fib $N))
+END
+
+for J in 1 2 4 8 16; do
+  echo "$J threads:"
+  time "$BLISP" -j "$J" < /tmp/blisp_parallel.in > /dev/null
+done
+rm -f /tmp/blisp_parallel.in
@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+# Running a large file with its forms read on the pool (-j N) while
+# earlier ones are evaluated, at 1, 4 and 16 threads. Forms are about
+# 10 kB of quoted data, so reading them is most of the work; times are
+# wall clock for the whole run. Reading only speeds up with the cores
+# there are to run the threads on
+# usage: bench/parse.sh [megabytes] (from the repo root, with ./blisp built)
+MB=${1:-100}
+BLISP=${BLISP:-./blisp}
+FILE=/tmp/blisp_parse.blisp
+
+ITEM='alpha beta (gamma 12 -345) {delta 6789} epsilon_1 + <= '
+FORM="(len {$(yes "$ITEM" | head -n 180 | tr -d '\n')})"
+yes "$FORM" | head -n $(( MB * 1048576 / (${#FORM} + 1) )) > "$FILE"
+
+echo "$(( $(stat -c %s "$FILE") / 1048576 )) MB, $(nproc) cores"
+"$BLISP" run "$FILE" > /tmp/blisp_parse.1
+for threads in 1 4 16; do
+  start=$(date +%s%N)
+  "$BLISP" -j $threads run "$FILE" > /tmp/blisp_parse.out
+  ms=$(( ($(date +%s%N) - start) / 1000000 ))
+  cmp -s /tmp/blisp_parse.1 /tmp/blisp_parse.out || echo "output differs!"
+  echo "-j $threads: $ms ms ($(( MB * 1000 / (ms ? ms : 1) )) MB/s)"
+done
+rm -f "$FILE" /tmp/blisp_parse.1 /tmp/blisp_parse.out
@@ -0,0 +1,15 @@
+#!/usr/bin/env bash
+# Five chained sequence stages over a million elements
+# usage: bench/pipeline.sh [n] (from the repo root, with ./blisp built)
+N=${1:-1000000}
+BLISP=${BLISP:-./blisp}
+
+cat > /tmp/blisp_pipeline.in <<END
+(def {sq} (\\ {x} {* x x}))
+(def {inc} (\\ {x} {+ x 1}))
+(def {odd} (\\ {x} {mod x 2}))
+(reduce + 0 (take $((N / 4)) (filter odd (map inc (map sq (range $N))))))
+END
+
+time "$BLISP" < /tmp/blisp_pipeline.in > /dev/null
+rm -f /tmp/blisp_pipeline.in
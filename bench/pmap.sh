@@ -0,0 +1,17 @@
+#!/usr/bin/env bash
+# pmap and preduce over a 100k element list at 1-16 threads
+# usage: bench/pmap.sh [n] (from the repo root, with ./blisp built)
+N=${1:-100000}
+BLISP=${BLISP:-./blisp}
+
+cat > /tmp/blisp_pmap.in <<END
+(def {f} (\\ {x} {+ (* x x) (/ x 3) (mod x 7) (max x 5) (min x 9)}))
+(len (pmap f (range $N)))
+(preduce + 0 (range $N))
+END
+
+for J in 1 2 4 8 16; do
+  echo "$J threads:"
+  time "$BLISP" -j "$J" < /tmp/blisp_pmap.in > /dev/null
+done
+rm -f /tmp/blisp_pmap.in
@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+# Printing a large nested list: n elements, each a list of a number, a
+# list and a quoted list. Times the run that prints it against one that
+# builds it and only prints its length, so the difference is printing
+# usage: bench/print.sh [n] (from the repo root, with ./blisp built)
+N=${1:-1000000}
+BLISP=${BLISP:-./blisp}
+
+cat > /tmp/blisp_print.blisp <<END
+(def {xs} (map (\\ {x} {list x (list x -1) {a {b c}}}) (range $N)))
+END
+cp /tmp/blisp_print.blisp /tmp/blisp_len.blisp
+echo 'xs' >> /tmp/blisp_print.blisp
+echo '(len xs)' >> /tmp/blisp_len.blisp
+
+ms() {
+  local start=$(date +%s%N)
+  "$BLISP" run "$1" > /tmp/blisp_print.out
+  echo $(( ($(date +%s%N) - start) / 1000000 ))
+}
+build=$(ms /tmp/blisp_len.blisp)
+total=$(ms /tmp/blisp_print.blisp)
+echo "$(( $(stat -c %s /tmp/blisp_print.out) / 1048576 )) MB printed"
+echo "building: $build ms, building and printing: $total ms, printing: $(( total - build )) ms"
+rm -f /tmp/blisp_print.blisp /tmp/blisp_len.blisp /tmp/blisp_print.out
@@ -0,0 +1,17 @@
+#!/usr/bin/env bash
+# Time spent in lval_read turning mpc's AST into lvals, on lines of large
+# nested lists, as reported by -d. -m keeps the hand-written reader out
+# of the way
+# usage: bench/read.sh [lines] [items per line] (from the repo root, with ./blisp built)
+N=${1:-10}
+ITEMS=${2:-10000}
+BLISP=${BLISP:-./blisp}
+
+ITEM='alpha (beta 12 -345) {gamma {6789 delta}} '
+LINE="(len {$(yes "$ITEM" | head -n "$ITEMS" | tr -d '\n')})"
+for ((i = 0; i < N; i++)); do echo "$LINE"; done > /tmp/blisp_read.in
+
+"$BLISP" -m -d < /tmp/blisp_read.in 2>&1 >/dev/null |
+  awk '/^parsed in/ { parse += $3; read += $7; n++ }
+       END { printf "%d lines: mpc_parse %.1f ms, lval_read %.1f ms\n", n, parse, read }'
+rm -f /tmp/blisp_read.in
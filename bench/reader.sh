@@ -0,0 +1,20 @@
+#!/usr/bin/env bash
+# Reading a large source, with the hand-written reader and with the mpc
+# grammar (-m). Each line is one big quoted list, so evaluating and
+# printing it costs next to nothing next to reading it
+# usage: bench/reader.sh [megabytes] (from the repo root, with ./blisp built)
+MB=${1:-100}
+BLISP=${BLISP:-./blisp}
+
+# about 1 MB per line
+ITEM='alpha beta (gamma 12 -345) {delta 6789} epsilon_1 + <= '
+LINE="(len {$(yes "$ITEM" | head -n 18000 | tr -d '\n')})"
+for ((i = 0; i < MB; i++)); do echo "$LINE"; done > /tmp/blisp_reader.in
+ls -l /tmp/blisp_reader.in
+
+echo "lval_read_src:"
+time "$BLISP" < /tmp/blisp_reader.in > /tmp/blisp_reader.src
+echo "mpc:"
+time "$BLISP" -m < /tmp/blisp_reader.in > /tmp/blisp_reader.mpc
+cmp -s /tmp/blisp_reader.src /tmp/blisp_reader.mpc || echo "outputs differ!"
+rm -f /tmp/blisp_reader.in /tmp/blisp_reader.src /tmp/blisp_reader.mpc
@@ -0,0 +1,11 @@
+#!/usr/bin/env bash
+# Variadic + over 10, 1k and 1M args
+# usage: bench/reduce.sh (from the repo root, with ./blisp built)
+BLISP=${BLISP:-./blisp}
+
+for N in 10 1000 1000000; do
+  { printf '(+'; seq -s ' ' 1 "$N" | sed 's/^/ /' | tr -d '\n'; printf ')\n'; } > /tmp/blisp_reduce.in
+  echo "$N args:"
+  time "$BLISP" < /tmp/blisp_reduce.in > /dev/null
+done
+rm -f /tmp/blisp_reduce.in
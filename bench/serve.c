@@ -0,0 +1,149 @@
+/* Load generator for blisp --serve: each client thread keeps one request */
+/* in flight on its own connection for the given time, then the rate */
+/* and latencies over all of them are printed. With -c every request is */
+/* made on a new connection instead, to time what connecting costs */
+/* cc --std=c99 -O2 -pthread bench/serve.c -o serve */
+/* ./serve [-c] SOCKET [clients] [seconds] [source] */
+
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+const char* path;
+const char* src;
+double seconds;
+int reconnect;
+
+typedef struct {
+  pthread_t thread;
+  /* latency of each request, in seconds */
+  double* lat;
+  long count, cap;
+  int failed;
+} client;
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int cmp(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+int full(int fd, char* buf, size_t len, int writing) {
+  while (len > 0) {
+    ssize_t n = writing ? write(fd, buf, len) : read(fd, buf, len);
+    if (n <= 0) { return 0; }
+    buf += n;
+    len -= n;
+  }
+  return 1;
+}
+
+int dial(void) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Send src as a request and read the reply into *reply, growing it as */
+/* needed. Returns the reply's length, or -1 if the connection failed */
+long ask(int fd, char** reply, size_t* cap) {
+  uint32_t len = strlen(src);
+  unsigned char head[4] = { len >> 24, len >> 16, len >> 8, len };
+  if (!full(fd, (char*)head, 4, 1) || !full(fd, (char*)src, len, 1)) { return -1; }
+  if (!full(fd, (char*)head, 4, 0)) { return -1; }
+  uint32_t n = (uint32_t)head[0] << 24 | head[1] << 16 | head[2] << 8 | head[3];
+  if (n + 1 > *cap) { *reply = realloc(*reply, *cap = n + 1); }
+  if (!full(fd, *reply, n, 0)) { return -1; }
+  (*reply)[n] = '\0';
+  return n;
+}
+
+void* run(void* arg) {
+  client* c = arg;
+  int fd = dial();
+  if (fd < 0) { c->failed = 1; return NULL; }
+  char* reply = NULL;
+  size_t cap = 0;
+
+  double end = now() + seconds;
+  for (double start = now(); start < end; start = now()) {
+    if (reconnect && c->count > 0) {
+      close(fd);
+      if ((fd = dial()) < 0) { c->failed = 1; break; }
+    }
+    if (ask(fd, &reply, &cap) < 0) { c->failed = 1; break; }
+    if (c->count == c->cap) { c->lat = realloc(c->lat, (c->cap = c->cap ? c->cap * 2 : 1024) * sizeof(double)); }
+    c->lat[c->count++] = now() - start;
+  }
+  if (fd >= 0) { close(fd); }
+  free(reply);
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "-c") == 0) { reconnect = 1; argv++; argc--; }
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s [-c] SOCKET [clients] [seconds] [source]\n", argv[0]);
+    return 2;
+  }
+  path = argv[1];
+  int n = argc > 2 ? atoi(argv[2]) : 16;
+  seconds = argc > 3 ? atof(argv[3]) : 2;
+  src = argc > 4 ? argv[4] : "+ 1 2";
+
+  /* one request first, to show what the server makes of it */
+  int fd = dial();
+  char* reply = NULL;
+  size_t cap = 0;
+  if (fd < 0 || ask(fd, &reply, &cap) < 0) { return 1; }
+  printf("%s -> %s\n", src, reply);
+  close(fd);
+  free(reply);
+
+  client* clients = calloc(n, sizeof(client));
+  double start = now();
+  for (int i = 0; i < n; i++) { pthread_create(&clients[i].thread, NULL, run, &clients[i]); }
+  for (int i = 0; i < n; i++) { pthread_join(clients[i].thread, NULL); }
+  double elapsed = now() - start;
+
+  long total = 0;
+  int failed = 0;
+  for (int i = 0; i < n; i++) { total += clients[i].count; failed += clients[i].failed; }
+  double* lat = malloc((total ? total : 1) * sizeof(double));
+  for (int i = 0, k = 0; i < n; i++) {
+    memcpy(lat + k, clients[i].lat, clients[i].count * sizeof(double));
+    k += clients[i].count;
+    free(clients[i].lat);
+  }
+  qsort(lat, total, sizeof(double), cmp);
+  if (total) {
+    printf("%3d clients: %8.0f req/s  p50 %7.3f ms  p99 %7.3f ms  max %7.3f ms%s%s\n", n,
+           total / elapsed, lat[total / 2] * 1e3, lat[total * 99 / 100] * 1e3,
+           lat[total - 1] * 1e3, reconnect ? "  (connecting each time)" : "",
+           failed ? "  (some connections failed)" : "");
+  } else {
+    printf("%3d clients: no requests completed\n", n);
+  }
+  free(lat);
+  free(clients);
+  return failed != 0;
+}
@@ -0,0 +1,43 @@
+#!/usr/bin/env bash
+# Requests per second and latency of blisp --serve, with fib defined by
+# the prelude: small requests from 1, 16 and 64 clients, then the same
+# small requests while one client keeps asking for fib 20, to see the
+# long evaluations sliced between them. Last, small requests each on a
+# new connection, with that prelude and with one of 20000 definitions,
+# to see what connecting costs as the prelude grows
+# usage: bench/serve.sh [seconds] (from the repo root, with ./blisp built)
+SECONDS_EACH=${1:-2}
+BLISP=${BLISP:-./blisp}
+SOCK=/tmp/blisp_serve.sock
+
+cc --std=c99 -O2 -pthread bench/serve.c -o /tmp/blisp_serve || exit 1
+echo '(def {fib} (\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))' > /tmp/blisp_prelude.blisp
+cp /tmp/blisp_prelude.blisp /tmp/blisp_prelude_large.blisp
+for ((i = 0; i < 20000; i++)); do echo "(def {v$i} $i)"; done >> /tmp/blisp_prelude_large.blisp
+
+start() {
+  rm -f "$SOCK"
+  "$BLISP" --serve "$SOCK" run "$1" > /dev/null &
+  server=$!
+  while [ ! -S "$SOCK" ]; do sleep 0.05; done
+}
+stop() { kill -INT $server; wait $server; }
+
+start /tmp/blisp_prelude.blisp
+for clients in 1 16 64; do
+  /tmp/blisp_serve "$SOCK" $clients "$SECONDS_EACH" "fib 8" | tail -1
+done
+echo "alongside fib 20:"
+/tmp/blisp_serve "$SOCK" 1 "$SECONDS_EACH" "fib 20" > /dev/null &
+long=$!
+/tmp/blisp_serve "$SOCK" 16 "$SECONDS_EACH" "fib 8" | tail -1
+wait $long
+echo "connecting, small prelude:"
+/tmp/blisp_serve -c "$SOCK" 16 "$SECONDS_EACH" "fib 8" | tail -1
+stop
+
+start /tmp/blisp_prelude_large.blisp
+echo "connecting, 20000 definitions:"
+/tmp/blisp_serve -c "$SOCK" 16 "$SECONDS_EACH" "fib 8" | tail -1
+stop
+rm -f /tmp/blisp_serve /tmp/blisp_prelude.blisp /tmp/blisp_prelude_large.blisp
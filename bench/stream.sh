@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+# Peak memory running a large generated file of independent top-level
+# forms, streamed through blisp - form by form, against the same forms
+# given to the REPL as a single line
+# usage: bench/stream.sh [megabytes] (from the repo root, with ./blisp built)
+MB=${1:-200}
+BLISP=${BLISP:-./blisp}
+
+FORM='(len {alpha beta (gamma 12 -345) {delta 6789}})'
+LINES=$(( MB * 1048576 / (${#FORM} + 1) ))
+forms() { yes "$FORM" | head -n "$LINES"; }
+
+# highest resident set of pid while it runs, in kB
+peak() {
+  local pid=$1 hwm=0 kb
+  while kb=$(awk '/VmHWM/ { print $2 }' /proc/$pid/status 2>/dev/null); [ -n "$kb" ]; do
+    hwm=$kb
+    sleep 0.05
+  done
+  echo "$hwm"
+}
+
+run() {
+  local start=$(date +%s%N)
+  "$@" > /dev/null &
+  local hwm=$(peak $!)
+  wait
+  echo "$(( ($(date +%s%N) - start) / 1000000 )) ms, peak $(( hwm / 1024 )) MB"
+}
+
+echo "$MB MB, $LINES forms"
+echo "streamed:  $(forms | run "$BLISP" -)"
+echo "one line:  $(forms | tr '\n' ' ' | run "$BLISP")"
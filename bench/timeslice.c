@@ -0,0 +1,78 @@
+/* Latency of short evaluations queued behind long ones on one thread, */
+/* run to completion in order and then round-robin in slices of fuel */
+/* cc --std=c99 -O2 -pthread -DBLISP_NO_MAIN -I. bench/timeslice.c blisp.c mpc.c -lreadline -lm -o timeslice */
+/* ./timeslice [short requests per long one] [fuel per slice] */
+
+#define _DEFAULT_SOURCE
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "blisp.h"
+
+#define LONGS 4
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int cmp(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/* Every request arrives at once; each long one is followed by shorts */
+void run(blisp_ctx* ctx, int shorts, long fuel) {
+  int n = LONGS * (shorts + 1);
+  blisp_task* tasks[n];
+  int is_long[n];
+  double done[n];
+  for (int i = 0; i < n; i++) {
+    is_long[i] = i % (shorts + 1) == 0;
+    tasks[i] = blisp_task_new(ctx, is_long[i] ? "fib 22" : "fib 8");
+  }
+
+  double start = now();
+  for (int left = n; left > 0;) {
+    for (int i = 0; i < n; i++) {
+      if (!tasks[i]) { continue; }
+      if (blisp_task_run(tasks[i], fuel)) { continue; }
+      char* out = blisp_task_output(tasks[i]);
+      if (strcmp(out, is_long[i] ? "17711" : "21") != 0) { fprintf(stderr, "bad result: %s\n", out); exit(1); }
+      free(out);
+      blisp_task_free(tasks[i]);
+      tasks[i] = NULL;
+      done[i] = (now() - start) * 1000;
+      left--;
+    }
+  }
+
+  double lat[n], slow = 0;
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    if (is_long[i]) { slow = done[i] > slow ? done[i] : slow; } else { lat[m++] = done[i]; }
+  }
+  qsort(lat, m, sizeof(double), cmp);
+  printf("short p50 %8.2f ms  p99 %8.2f ms  long max %8.2f ms\n",
+    lat[m / 2], lat[m * 99 / 100], slow);
+}
+
+int main(int argc, char** argv) {
+  int shorts = argc > 1 ? atoi(argv[1]) : 50;
+  long fuel = argc > 2 ? atol(argv[2]) : 1000;
+
+  blisp_ctx* ctx = blisp_ctx_new();
+  free(blisp_eval(ctx, "def {fib} (\\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})"));
+
+  printf("to completion:    ");
+  run(ctx, shorts, LONG_MAX);
+  printf("%ld fuel slices: ", fuel);
+  run(ctx, shorts, fuel);
+
+  blisp_ctx_free(ctx);
+  return 0;
+}
@@ -0,0 +1,162 @@
+/* The reader's structural index: each classifier checked against the */
+/* character table and the reader using it against the mpc grammar, */
+/* then the throughput of classifying alone and of reading */
+/* cc --std=c99 -O2 -pthread -DBLISP_NO_MAIN -I. bench/tokenizer.c mpc.c -lreadline -lm -o tokenizer */
+/* ./tokenizer [MB] */
+
+#include "blisp.c"
+
+struct {
+  const char* name;
+  void (*classify)(const char*, lindex_masks*);
+} levels[] = {
+  { "scalar", lindex_classify_scalar },
+#if defined(__SSE2__)
+  { "sse2", lindex_classify_sse2 },
+  { "avx2", lindex_classify_avx2 },
+#endif
+};
+int nlevels = sizeof(levels) / sizeof(levels[0]);
+
+int available(int level) {
+#if defined(__SSE2__)
+  if (levels[level].classify == lindex_classify_avx2) { return __builtin_cpu_supports("avx2"); }
+#endif
+  return 1;
+}
+
+/* What reading src gives, printed, or NULL if it's rejected */
+char* read_with(const char* src, size_t len, int mpc) {
+  lval* v = NULL;
+  if (mpc) {
+    mpc_result_t r;
+    if (mpc_nparse("<test>", src, len, lgrammar.Blisp, &r)) {
+      v = lval_read(r.output);
+      mpc_ast_delete(r.output);
+    } else {
+      mpc_err_delete(r.error);
+    }
+  } else {
+    v = lval_read_src(src, len);
+  }
+  if (!v) { return NULL; }
+  char* buf;
+  size_t n;
+  FILE* out = open_memstream(&buf, &n);
+  lval_fprint(out, v);
+  fclose(out);
+  lval_del(v);
+  return buf;
+}
+
+/* Source made of random tokens, some of them out of the grammar */
+size_t random_src(char* buf, size_t max) {
+  static const char* tokens[] = {
+    "(", ")", "{", "}", " ", "  ", "\n", "\t", "12", "-3", "-", "0", "abc", "a-1", "+",
+    "x_y", "<=", "9223372036854775808", "-9223372036854775808", "12ab", "-x", "--4",
+    "\\", "!&*/", "#", "\"", "\xc3\xa9", ";", "\r\n", "\v",
+  };
+  int ntokens = sizeof(tokens) / sizeof(tokens[0]);
+  size_t len = 0;
+  size_t want = rand() % max;
+  while (len < want) {
+    /* mostly valid, so most cases get past the first few bytes */
+    int valid = rand() % 8;
+    const char* t = tokens[rand() % (valid ? ntokens - 9 : ntokens)];
+    size_t n = strlen(t);
+    if (len + n > max) { break; }
+    memcpy(buf + len, t, n);
+    len += n;
+  }
+  return len;
+}
+
+double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+  size_t mb = argc > 1 ? atol(argv[1]) : 64;
+  int failed = 0;
+  srand(1);
+
+  /* every byte value in every position, then random blocks */
+  char block[64];
+  for (int t = 0; t < 256 * 64 + 100000; t++) {
+    for (int i = 0; i < 64; i++) { block[i] = rand(); }
+    if (t < 256 * 64) { block[t % 64] = t / 64; }
+    lindex_masks want, got;
+    lindex_classify_scalar(block, &want);
+    for (int l = 1; l < nlevels; l++) {
+      if (!available(l)) { continue; }
+      levels[l].classify(block, &got);
+      if (got.space != want.space || got.bracket != want.bracket || got.sym != want.sym) {
+        if (failed++ < 10) { printf("%s misclassifies a block (test %d)\n", levels[l].name, t); }
+      }
+    }
+  }
+
+  /* the reader with each classifier, against the grammar */
+  pthread_once(&lgrammar_once, lgrammar_init);
+  pthread_once(&lindex_once, lindex_init);
+  char src[400];
+  int cases = 20000, accepted = 0;
+  for (int t = 0; t < cases; t++) {
+    size_t len = random_src(src, t % 2 ? sizeof(src) : 80);
+    char* want = read_with(src, len, 1);
+    accepted += want != NULL;
+    for (int l = 0; l < nlevels; l++) {
+      if (!available(l)) { continue; }
+      lindex_classify = levels[l].classify;
+      char* got = read_with(src, len, 0);
+      if ((want == NULL) != (got == NULL) || (want && strcmp(want, got) != 0)) {
+        if (failed++ < 10) {
+          printf("%s reads %.*s as %s, not %s\n", levels[l].name, (int)len, src,
+                 got ? got : "an error", want ? want : "an error");
+        }
+      }
+      free(got);
+    }
+    free(want);
+  }
+  printf("%d blocks and %d sources (%d valid) checked: %s\n", 256 * 64 + 100000, cases,
+         accepted, failed ? "FAILED" : "ok");
+
+  /* throughput, on lines of typical source. Reading goes over the */
+  /* first MB again and again, so it's timed on memory malloc has */
+  /* already faulted in */
+  const char* line = "(def {f} (\\ {x y} {if (< x y) {+ x 12345} {* (- x y) -42}}))\n";
+  size_t n = strlen(line), size = mb << 20;
+  char* big = malloc(size);
+  for (size_t i = 0; i < size; i += n) { memcpy(big + i, line, size - i < n ? size - i : n); }
+  size_t chunk = 1 << 20;
+  for (size_t i = size - 1; big[i] != '\n'; i--) { big[i] = ' '; }
+  for (size_t i = chunk - 1; big[i] != '\n'; i--) { big[i] = ' '; }
+  for (int l = 0; l < nlevels; l++) {
+    if (!available(l)) { continue; }
+    lindex_classify = levels[l].classify;
+    lindex_masks m;
+    uint64_t seen = 0;
+    double start = now();
+    for (size_t i = 0; i + 64 <= size; i += 64) {
+      lindex_classify(big + i, &m);
+      seen += m.sym ^ m.bracket ^ m.space;
+    }
+    double classified = now() - start;
+    int forms = 0;
+    double read = 0;
+    for (size_t i = 0; i < size; i += chunk) {
+      start = now();
+      lval* v = lval_read_src(big, chunk);
+      read += now() - start;
+      forms += v->count;
+      lval_del(v);
+    }
+    printf("%-6s classify %5.2f GB/s, read %5.3f GB/s (%d forms, %llx)\n", levels[l].name,
+           size / classified / 1e9, size / read / 1e9, forms, (unsigned long long)seen);
+  }
+  free(big);
+  return failed != 0;
+}
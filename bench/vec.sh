@@ -0,0 +1,58 @@
+#!/usr/bin/env bash
+# Vector arithmetic checked against the same ops on each element as
+# scalars, over values at and around the edges of a long (LONG_MIN / -1,
+# overflowing sums, wrapping products), with two operands and with three,
+# where a sum that overflows partway may still fit, then the time for each
+# usage: bench/vec.sh [rows] (from the repo root, with ./blisp built)
+N=${1:-2000}
+BLISP=${BLISP:-./blisp}
+
+VALUES=(-9223372036854775808 9223372036854775807 -4611686018427387904 4611686018427387904
+        -1 1 -2 2 3 -7 0 1000000007 -123456789)
+OPS=(+ - '*' / min max)
+pick() {
+  local out=""
+  for ((k = 0; k < 8; k++)); do
+    local x=${VALUES[RANDOM % ${#VALUES[@]}]}
+    # division by zero is checked on its own, as the two report it
+    # before or after an overflow in the same row
+    while [ "$1" = / ] && [ "$x" = 0 ]; do x=${VALUES[RANDOM % ${#VALUES[@]}]}; done
+    out="$out $x"
+  done
+  echo "{${out# }}"
+}
+
+RANDOM=1
+zip='(def {zip} (\ {f xs ys} {if (== xs {}) {{}} {cons (f (eval (head xs)) (eval (head ys))) (zip f (tail xs) (tail ys))}}))'
+zip3='(def {zip3} (\ {f xs ys zs} {if (== xs {}) {{}} {cons (f (eval (head xs)) (eval (head ys)) (eval (head zs))) (zip3 f (tail xs) (tail ys) (tail zs))}}))'
+{ echo "$zip"; echo "$zip3"; } > /tmp/blisp_vec.in
+{ echo "$zip"; echo "$zip3"; } > /tmp/blisp_scalar.in
+for ((i = 0; i < N; i++)); do
+  op=${OPS[RANDOM % ${#OPS[@]}]}
+  xs=$(pick) ys=$(pick "$op") zs=$(pick "$op")
+  s=${VALUES[RANDOM % ${#VALUES[@]}]} t=${VALUES[RANDOM % ${#VALUES[@]}]}
+  [ "$op" = / ] && [ "$s" = 0 ] && s=-1
+  [ "$op" = / ] && [ "$t" = 0 ] && t=-1
+  echo "(unvec ($op (vec $xs) (vec $ys)))" >> /tmp/blisp_vec.in
+  echo "(zip $op $xs $ys)" >> /tmp/blisp_scalar.in
+  echo "(unvec ($op (vec $xs) $s))" >> /tmp/blisp_vec.in
+  echo "(map (\\ {x} {$op x $s}) $xs)" >> /tmp/blisp_scalar.in
+  echo "(unvec (- (vec $xs)))" >> /tmp/blisp_vec.in
+  echo "(map (\\ {x} {- x}) $xs)" >> /tmp/blisp_scalar.in
+  echo "(unvec ($op (vec $xs) (vec $ys) (vec $zs)))" >> /tmp/blisp_vec.in
+  echo "(zip3 $op $xs $ys $zs)" >> /tmp/blisp_scalar.in
+  echo "(unvec ($op (vec $xs) $s $t))" >> /tmp/blisp_vec.in
+  echo "(map (\\ {x} {$op x $s $t}) $xs)" >> /tmp/blisp_scalar.in
+done
+echo '(unvec (+ (vec {9223372036854775807}) 1 -1))' >> /tmp/blisp_vec.in
+echo '(map (\ {x} {+ x 1 -1}) {9223372036854775807})' >> /tmp/blisp_scalar.in
+echo '(unvec (/ (vec {1 2}) (vec {1 0})))' >> /tmp/blisp_vec.in
+echo '(zip / {1 2} {1 0})' >> /tmp/blisp_scalar.in
+
+echo "vectors:"
+time "$BLISP" run /tmp/blisp_vec.in > /tmp/blisp_vec.out
+echo "scalars:"
+time "$BLISP" run /tmp/blisp_scalar.in > /tmp/blisp_scalar.out
+echo "$(grep -c Error /tmp/blisp_vec.out) of $((5 * N + 2)) rows are errors"
+cmp -s /tmp/blisp_vec.out /tmp/blisp_scalar.out || echo "outputs differ!"
+rm -f /tmp/blisp_vec.in /tmp/blisp_scalar.in /tmp/blisp_vec.out /tmp/blisp_scalar.out
@@ -1,7 +1,15 @@
+/* getline and friends under --std=c99 */
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include "mpc.h"
+#include "blisp.h"
 
 
 /* Faking readline on Windows platforms */
@@ -25,33 +33,52 @@ void add_history(char* unused) {}
 
 /* Otherwise include the readline headers */
 #else
+#include <unistd.h>
 #include <readline/readline.h>
 #include <readline/history.h>
+
+/* readline redraws the whole line as it grows, which is quadratic on */
+/* the huge lines benchmarks pipe in, so only use it interactively */
+char* blisp_readline(char* prompt) {
+  if (isatty(STDIN_FILENO)) { return readline(prompt); }
+
+  char* line = NULL;
+  size_t cap = 0;
+  ssize_t n = getline(&line, &cap, stdin);
+  if (n < 0) { free(line); return NULL; }
+  if (n > 0 && line[n-1] == '\n') { line[n-1] = '\0'; }
+  return line;
+}
+#define readline blisp_readline
 #endif
 
 /* MACROS */
 
+#define BLISP_VERSION "0.0.1"
+
 #define LASSERT(args, cond, err) \
   if (!(cond)) { lval_del(args); return lval_err(err); }
 
-#define LASSERT_ARG_NUM(args, num) \
-  LASSERT(args, args->count <= num, "Function passed too many args!");
-
 #define LASSERT_EMPTY_LIST(args) \
   LASSERT(args, args->cell[0]->count != 0, "Function called on empty list")
 
-#define LASSERT_TYPE(args, expected) \
-  LASSERT(args, args->cell[0]->type == expected, "Function called with incorrect type")
-
 /* TYPES */
 
 struct lval;
 struct lenv;
+struct lclosure;
+struct lseq;
+struct lfuture;
+struct lsig;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lclosure lclosure;
+typedef struct lseq lseq;
+typedef struct lfuture lfuture;
+typedef struct lsig lsig;
 
 /* lval variants */
-enum { LVAL_FUN, LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_FUN, LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_VEC, LVAL_SEQ, LVAL_FUT };
 
 /* function pointer! */
 typedef lval*(*lbuiltin)(lenv*, lval*);
@@ -60,20 +87,114 @@ typedef struct lval {
   int type;/* LVAL_**/ 
   /* if LVAL_NUM */
   long num;
-  /* if LVAL_ERR */
+  /* if LVAL_ERR - always a string literal, so never copied or freed */
   char* err;
-  /* if LVAL_SYM */ 
+  /* if LVAL_SYM - interned, see lsym_intern */
   char* sym;
-  /* if FUN */
+  /* if LVAL_SYM in a closure's body - the closure whose call frames it */
+  /* can be found in by index, and the index (see lclosure_resolve) */
+  lclosure* slot_in;
+  int slot;
+  /* if FUN - builtins have fun and sig set, user-defined functions a closure */
   lbuiltin fun;
-  /* if LVAL_SEXPR | LVAL_QEXPR */
+  lsig* sig;
+  lclosure* closure;
+  /* if LVAL_SEXPR | LVAL_QEXPR | LVAL_VEC */
   int count;
   struct lval** cell;
+  /* if LVAL_SEXPR | LVAL_QEXPR - set by lval_infer on a call site whose */
+  /* args are known to fit typed's signature, as of typed_gen */
+  lsig* typed;
+  long typed_gen;
+  /* if LVAL_VEC - unboxed numbers, stored contiguously */
+  long* vec;
+  /* if LVAL_SEQ */
+  lseq* seq;
+  /* if LVAL_FUT */
+  lfuture* fut;
 } lval;
 
+/* A builtin's entry in the registry, see LBUILTINS */
+struct lsig {
+  char* name;
+  lbuiltin fun;
+  /* fewest and most args, max -1 for any number */
+  int min, max;
+  /* a type code per arg, the last one repeating for any more */
+  char* types;
+  /* the type code of what it returns */
+  char ret;
+};
+
 /* error variants */
 enum { LERR_DIV_ZERO, LERR_BAD_OP, LERR_BAD_NUM };
 
+/* A sym corresponds to val at the same index */
+/* Lookups that miss fall through to the parent, if any */
+struct lenv {
+  lenv* par;
+  int count;
+  char** syms;
+  lval** vals;
+  /* if a call frame, the closure called */
+  lclosure* closure;
+  /* read-only and under other scopes' globals, like the server's */
+  /* prelude: def binds in the scope over it instead */
+  int shared;
+};
+
+/* A lazy sequence: either a source, or a stage applied to the sequence */
+/* up. Immutable once built, so copies and longer pipelines share nodes */
+enum { LSEQ_RANGE, LSEQ_LIST, LSEQ_GEN, LSEQ_MAP, LSEQ_FILTER, LSEQ_TAKE };
+
+struct lseq {
+  int refs;
+  int kind;
+  /* if LSEQ_RANGE */
+  long from, to, step;
+  /* if LSEQ_LIST - a Qexpr or vector */
+  lval* list;
+  /* if a stage */
+  lseq* up;
+  /* the function of a map or filter, or the body of a generator */
+  lval* f;
+  /* how many a take keeps */
+  long n;
+};
+
+/* An expression being evaluated on its own thread, against a snapshot */
+/* of the environment. Shared by its lvals and the thread, the last of */
+/* which to let go frees it */
+struct lfuture {
+  int refs;
+  /* single-slot channel: the thread stores its result here exactly once */
+  lval* slot;
+  /* awaiting callers that find the slot empty block on this */
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  lenv* env;
+  lval* expr;
+};
+
+/* A user-defined function, shared between all copies of its lval */
+/* Variables the body uses from enclosing local scopes are copied in */
+/* when the lambda is created, so calls never walk the creator's frames */
+struct lclosure {
+  int refs;
+  /* parameter names, the index is the argument position */
+  int argc;
+  char** formals;
+  /* flat closure record, its par is unused */
+  lenv captured;
+  /* an sexpr, evaluated in place by every call */
+  lval* body;
+  /* whether calls are safe to evaluate in parallel, as of lenv_generation */
+  /* par_gen and with the globals of par_root (see lpar_safe) */
+  long par_gen;
+  lenv* par_root;
+  int par_safe;
+};
+
 /* Type Constructors */
 /* Each constructor returns a pointer to a heap-allocated lval */
 
@@ -89,17 +210,80 @@ lval* lval_num(long x) {
 lval* lval_err(char* message) {
   lval* v = malloc(sizeof(lval));
   v->type = LVAL_ERR;
-  v->err = malloc(strlen(message) + 1); /* because strlen excludes the null terminator but we (obviously) still need it */
-  strcpy(v->err, message);
+  v->err = message;
   return v;
 }
 
+/* Symbol names are interned: each is stored once, for good, so symbols */
+/* copy as a pointer and two names are the same exactly when their */
+/* pointers are. The table is shared by every thread */
+struct {
+  pthread_mutex_t lock;
+  long count;
+  /* a power of two, kept at most half full */
+  long size;
+  char** slots;
+} lsyms = { PTHREAD_MUTEX_INITIALIZER, 0, 0, NULL };
+
+/* Each thread's most recent names, so most lookups skip the lock */
+#define LSYM_CACHE 256
+__thread char* lsym_cache[LSYM_CACHE];
+
+unsigned long lsym_hash(const char* s, size_t len) {
+  unsigned long h = 14695981039346656037UL;
+  for (size_t i = 0; i < len; i++) { h = (h ^ (unsigned char)s[i]) * 1099511628211UL; }
+  return h;
+}
+
+/* The interned copy of the len chars at s */
+char* lsym_intern_len(const char* s, size_t len) {
+  unsigned long h = lsym_hash(s, len);
+  char** cached = &lsym_cache[h % LSYM_CACHE];
+  if (*cached && strncmp(*cached, s, len) == 0 && (*cached)[len] == '\0') { return *cached; }
+
+  pthread_mutex_lock(&lsyms.lock);
+  if (2 * (lsyms.count + 1) > lsyms.size) {
+    long size = lsyms.size ? lsyms.size * 2 : 1024;
+    char** slots = calloc(size, sizeof(char*));
+    for (long i = 0; i < lsyms.size; i++) {
+      char* x = lsyms.slots[i];
+      if (!x) { continue; }
+      long j = lsym_hash(x, strlen(x)) & (size - 1);
+      while (slots[j]) { j = (j + 1) & (size - 1); }
+      slots[j] = x;
+    }
+    free(lsyms.slots);
+    lsyms.slots = slots;
+    lsyms.size = size;
+  }
+
+  long j = h & (lsyms.size - 1);
+  char* x;
+  while ((x = lsyms.slots[j])) {
+    if (strncmp(x, s, len) == 0 && x[len] == '\0') { break; }
+    j = (j + 1) & (lsyms.size - 1);
+  }
+  if (!x) {
+    x = malloc(len + 1);
+    memcpy(x, s, len);
+    x[len] = '\0';
+    lsyms.slots[j] = x;
+    lsyms.count++;
+  }
+  pthread_mutex_unlock(&lsyms.lock);
+
+  *cached = x;
+  return x;
+}
+
+char* lsym_intern(const char* s) { return lsym_intern_len(s, strlen(s)); }
+
 /* symbol */
 lval* lval_sym(char* s) {
   lval* v = malloc(sizeof(lval));
   v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);
-  strcpy(v->sym, s);
+  v->sym = lsym_intern(s);
+  v->slot_in = NULL;
   return v;
 }
 
@@ -109,6 +293,7 @@ lval* lval_sexpr(void) {
   v->type = LVAL_SEXPR;
   v->count = 0;
   v->cell = NULL;
+  v->typed = NULL;
   return v;
 }
 
@@ -118,58 +303,255 @@ lval* lval_qexpr(void) {
   v->type = LVAL_QEXPR;
   v->count = 0;
   v->cell = NULL;
+  v->typed = NULL;
+  return v;
+}
+
+/* vector of count numbers, left uninitialized */
+lval* lval_vec(int count) {
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_VEC;
+  v->count = count;
+  v->vec = malloc(sizeof(long) * (count > 0 ? count : 1));
   return v;
 }
 
 /* function */
-lval* lval_fun(lbuiltin func) {
+lval* lval_fun(lsig* sig) {
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_FUN;
+  v->fun = sig->fun;
+  v->sig = sig;
+  v->closure = NULL;
+  return v;
+}
+
+/* lazy sequence, takes ownership of the node */
+lval* lval_seq(lseq* s) {
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_SEQ;
+  v->seq = s;
+  return v;
+}
+
+/* future handle, takes ownership of a reference to f */
+lval* lval_fut(lfuture* f) {
+  lval* v = malloc(sizeof(lval));
+  v->type = LVAL_FUT;
+  v->fut = f;
+  return v;
+}
+
+/* user-defined function, takes ownership of the closure */
+lval* lval_lambda(lclosure* c) {
   lval* v = malloc(sizeof(lval));
   v->type = LVAL_FUN;
-  v->fun = func;
+  v->fun = NULL;
+  v->sig = NULL;
+  v->closure = c;
   return v;
 }
 
 /* PRINT */
 
-void lval_print(lval* v); 
+/* Output is built up in a growable buffer and written out in large */
+/* pieces, rather than through stdio a bracket or a number at a time */
+#define LBUF_FLUSH 65536
 
-void lval_expr_print(lval* v, char open, char close) {
-  putchar(open);
-  for (int i = 0; i < v->count; i++) {
-    lval_print(v->cell[i]);
-    if (i != (v->count-1)) {
-      putchar(' ');
-    }
+typedef struct {
+  char* buf;
+  size_t len;
+  size_t cap;
+  /* where it's written once it's LBUF_FLUSH long, or NULL to keep it */
+  FILE* out;
+} lbuf;
+
+void lbuf_flush(lbuf* b) {
+  if (b->out && b->len) { fwrite(b->buf, 1, b->len, b->out); }
+  b->len = 0;
+}
+
+void lbuf_put(lbuf* b, const char* s, size_t n) {
+  if (b->len + n > b->cap && b->out && b->cap >= LBUF_FLUSH) { lbuf_flush(b); }
+  if (b->len + n > b->cap) {
+    while (b->len + n > b->cap) { b->cap *= 2; }
+    b->buf = realloc(b->buf, b->cap);
   }
+  memcpy(b->buf + b->len, s, n);
+  b->len += n;
+}
 
-  putchar(close);
+void lbuf_putc(lbuf* b, char c) {
+  if (b->len < b->cap) { b->buf[b->len++] = c; } else { lbuf_put(b, &c, 1); }
 }
 
-void lval_print(lval* v) {
-  switch (v->type) {
-    case LVAL_FUN:   printf("<function>"); break;
-    case LVAL_NUM:   printf("%li", v->num); break;
-    case LVAL_ERR:   printf("Error: %s", v->err); break;
-    case LVAL_SYM:   printf("%s", v->sym); break;
-    case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
-    case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+void lbuf_puts(lbuf* b, const char* s) { lbuf_put(b, s, strlen(s)); }
+
+/* x in decimal, as %li would print it */
+void lbuf_num(lbuf* b, long x) {
+  char digits[24];
+  int n = sizeof(digits);
+  unsigned long u = x < 0 ? 0UL - (unsigned long)x : (unsigned long)x;
+  do { digits[--n] = '0' + u % 10; u /= 10; } while (u);
+  if (x < 0) { digits[--n] = '-'; }
+  lbuf_put(b, digits + n, sizeof(digits) - n);
+}
+
+/* A list being printed, the next of its cells, and what closes it */
+typedef struct {
+  lval* v;
+  int i;
+  const char* close;
+} lprint_frame;
+
+/* Print v into b, keeping the lists it's inside on a stack of its own */
+/* rather than recursing, so nesting of any depth prints */
+void lval_print_to(lbuf* b, lval* v) {
+  lprint_frame local[32];
+  lprint_frame* stack = local;
+  int depth = 0;
+  int cap = 32;
+  while (1) {
+    /* v itself, or if it's a list, its opening and a frame for the rest */
+    lprint_frame list = { NULL, 0, NULL };
+    switch (v->type) {
+      case LVAL_FUN:
+        if (v->fun) { lbuf_puts(b, "<function>"); break; }
+        lbuf_puts(b, "(\\ {");
+        for (int i = 0; i < v->closure->argc; i++) {
+          if (i) { lbuf_putc(b, ' '); }
+          lbuf_puts(b, v->closure->formals[i]);
+        }
+        lbuf_puts(b, "} {");
+        list = (lprint_frame){ v->closure->body, 0, "})" };
+        break;
+      case LVAL_NUM: lbuf_num(b, v->num); break;
+      case LVAL_ERR: lbuf_puts(b, "Error: "); lbuf_puts(b, v->err); break;
+      case LVAL_SYM: lbuf_puts(b, v->sym); break;
+      case LVAL_SEXPR: lbuf_putc(b, '('); list = (lprint_frame){ v, 0, ")" }; break;
+      case LVAL_QEXPR: lbuf_putc(b, '{'); list = (lprint_frame){ v, 0, "}" }; break;
+      case LVAL_VEC:
+        lbuf_putc(b, '[');
+        for (int i = 0; i < v->count; i++) {
+          if (i) { lbuf_putc(b, ' '); }
+          lbuf_num(b, v->vec[i]);
+        }
+        lbuf_putc(b, ']');
+        break;
+      /* only reachable from C, the REPL forces sequences before printing */
+      case LVAL_SEQ: lbuf_puts(b, "<sequence>"); break;
+      case LVAL_FUT:
+        lbuf_puts(b, __atomic_load_n(&v->fut->slot, __ATOMIC_ACQUIRE) ? "<future: ready>" : "<future>");
+        break;
+    }
+    if (list.v) {
+      if (depth == cap) {
+        cap *= 2;
+        if (stack == local) {
+          stack = malloc(sizeof(lprint_frame) * cap);
+          memcpy(stack, local, sizeof(local));
+        } else {
+          stack = realloc(stack, sizeof(lprint_frame) * cap);
+        }
+      }
+      stack[depth++] = list;
+    }
+
+    /* then on to the next cell of the innermost list with any left */
+    while (depth > 0 && stack[depth-1].i == stack[depth-1].v->count) {
+      lbuf_puts(b, stack[--depth].close);
+    }
+    if (depth == 0) { break; }
+    lprint_frame* top = &stack[depth-1];
+    if (top->i > 0) { lbuf_putc(b, ' '); }
+    v = top->v->cell[top->i++];
   }
+  if (stack != local) { free(stack); }
+}
+
+void lval_fprint(FILE* out, lval* v) {
+  lbuf b = { malloc(256), 0, 256, out };
+  lval_print_to(&b, v);
+  lbuf_flush(&b);
+  free(b.buf);
+}
+
+/* v as it prints, in a string the caller frees */
+char* lval_to_string(lval* v) {
+  lbuf b = { malloc(256), 0, 256, NULL };
+  lval_print_to(&b, v);
+  lbuf_putc(&b, '\0');
+  return b.buf;
 }
 
+void lval_print(lval* v) { lval_fprint(stdout, v); }
+
 /* Print an "lval" followed by a newline */
 void lval_println(lval* v) { lval_print(v); putchar('\n'); }
 
+void lval_del(lval* v);
+
+/* The loaded image, if any (see IMAGES). Everything in it stays mapped */
+/* for good, so the destructors leave it alone */
+char* limage_base = NULL;
+char* limage_end = NULL;
+
+int limage_owns(void* p) {
+  return (char*)p >= limage_base && (char*)p < limage_end;
+}
+
+/* Drop a reference to a closure, freeing it with the last one */
+void lclosure_del(lclosure* c) {
+  if (limage_owns(c)) { return; }
+  if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) > 0) { return; }
+  free(c->formals);
+  for (int i = 0; i < c->captured.count; i++) {
+    lval_del(c->captured.vals[i]);
+  }
+  free(c->captured.syms);
+  free(c->captured.vals);
+  lval_del(c->body);
+  free(c);
+}
+
+/* Drop a reference to a sequence node and, with it, its upstream */
+void lseq_del(lseq* s) {
+  while (s && __atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    lseq* up = s->up;
+    if (s->list) { lval_del(s->list); }
+    if (s->f) { lval_del(s->f); }
+    free(s);
+    s = up;
+  }
+}
+
+void lenv_del(lenv* e);
+
+void lfuture_del(lfuture* f) {
+  if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) > 0) { return; }
+  lval* x = __atomic_load_n(&f->slot, __ATOMIC_ACQUIRE);
+  if (x) { lval_del(x); }
+  pthread_mutex_destroy(&f->lock);
+  pthread_cond_destroy(&f->ready);
+  free(f);
+}
+
 /* lval type Destructor */
 /* no fancy Rust Drop semantics :( */
 void lval_del(lval* v) {
+  if (limage_owns(v)) { return; }
   switch(v->type) {
+    /* lambdas share their closure, builtins have nothing malloc'd */
+    case LVAL_FUN: if (v->closure) { lclosure_del(v->closure); } break;
     // Nothing malloc'd
-    case LVAL_FUN:
     case LVAL_NUM: break;
+    case LVAL_ERR: break;
+    case LVAL_SYM: break;
 
     /* Free the char* if applicable */
-    case LVAL_ERR: free(v->err); break;
-    case LVAL_SYM: free(v->sym); break;
+    case LVAL_VEC: free(v->vec); break;
+    case LVAL_SEQ: lseq_del(v->seq); break;
+    case LVAL_FUT: lfuture_del(v->fut); break;
 
     case LVAL_QEXPR:
     case LVAL_SEXPR:
@@ -194,23 +576,47 @@ lval* lval_copy(lval* v) {
 
   switch (v->type) {
     /* functions and numbers can copy directly */
-    case LVAL_FUN: x->fun = v->fun; break;
+    /* closures are immutable, so copies share them */
+    case LVAL_FUN:
+      x->fun = v->fun;
+      x->sig = v->sig;
+      x->closure = v->closure;
+      if (x->closure) { __atomic_add_fetch(&x->closure->refs, 1, __ATOMIC_RELAXED); }
+      break;
     case LVAL_NUM: x->num = v->num; break;
 
-    /* strings need malloc and strcpy */
-    case LVAL_ERR:
-      x->err = malloc(strlen(v->err) + 1);
-      strcpy(x->sym, v->sym); break;
+    /* error messages are literals and symbols are interned. A copy is */
+    /* out of the body it was resolved in, so looks itself up by name */
+    case LVAL_ERR: x->err = v->err; break;
+    case LVAL_SYM: x->sym = v->sym; x->slot_in = NULL; break;
 
     /* Copy lists by copying each sub-expression */
     case LVAL_QEXPR:
     case LVAL_SEXPR:
+      x->typed = v->typed;
+      x->typed_gen = v->typed_gen;
       x->count = v->count;
       x->cell = malloc(sizeof(lval*) * x->count);
       for (int i = 0; i < x->count; i++) {
         x->cell[i] = lval_copy(v->cell[i]);
       }
       break;
+
+    case LVAL_VEC:
+      x->count = v->count;
+      x->vec = malloc(sizeof(long) * (x->count ? x->count : 1));
+      memcpy(x->vec, v->vec, sizeof(long) * x->count);
+      break;
+
+    case LVAL_SEQ:
+      x->seq = v->seq;
+      __atomic_add_fetch(&x->seq->refs, 1, __ATOMIC_RELAXED);
+      break;
+
+    case LVAL_FUT:
+      x->fut = v->fut;
+      __atomic_add_fetch(&x->fut->refs, 1, __ATOMIC_RELAXED);
+      break;
   }
 
   return x;
@@ -234,28 +640,212 @@ lval* lval_take(lval* v, int i) {
   return x;
 }
 
-/* ENVIRONMENT */
+/* MEMO */
 
-/* A sym corresponds to val at the same index */
-struct lenv {
-  int count;
-  char** syms;
-  lval** vals;
-};
+/* A bounded cache of results of pure builtin calls, keyed by the builtin */
+/* and a structural hash of its evaluated arguments, evicted LRU-first */
+
+#define LMEMO_SIZE 256
+#define LMEMO_BUCKETS 512
+/* Arguments bigger than this are cheaper to recompute than to compare */
+#define LMEMO_MAX_NODES 64
+
+typedef struct lmemo_entry {
+  unsigned long hash;
+  lbuiltin fun;
+  lval* args;
+  lval* result;
+  /* bucket chain */
+  struct lmemo_entry* next;
+  /* recency list, most recent first */
+  struct lmemo_entry* newer;
+  struct lmemo_entry* older;
+} lmemo_entry;
+
+/* Each thread has its own cache, so workers never contend on it */
+__thread struct {
+  lmemo_entry entries[LMEMO_SIZE];
+  int used;
+  lmemo_entry* buckets[LMEMO_BUCKETS];
+  lmemo_entry* newest;
+  lmemo_entry* oldest;
+  long hits;
+  long misses;
+  /* the lmemo_generation the entries were computed in */
+  long generation;
+  /* whether lmemo_key knows to clear this thread's cache on exit */
+  int registered;
+} lmemo;
+
+/* Bumped whenever a function binding is replaced, which invalidates */
+/* every thread's cache */
+long lmemo_generation = 0;
+
+/* FNV-1a over the structure of v, counting nodes as it goes */
+unsigned long lval_hash(lval* v, unsigned long h, int* nodes) {
+  (*nodes)++;
+  h = (h ^ (unsigned long)v->type) * 1099511628211UL;
+  switch (v->type) {
+    case LVAL_NUM: h = (h ^ (unsigned long)v->num) * 1099511628211UL; break;
+    case LVAL_FUN:
+      h = (h ^ (unsigned long)v->fun ^ (unsigned long)v->closure) * 1099511628211UL;
+      break;
+    case LVAL_ERR:
+    case LVAL_SYM: {
+      char* s = v->type == LVAL_ERR ? v->err : v->sym;
+      while (*s) { h = (h ^ (unsigned char)*s++) * 1099511628211UL; }
+      break;
+    }
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      h = (h ^ (unsigned long)v->count) * 1099511628211UL;
+      for (int i = 0; i < v->count && *nodes <= LMEMO_MAX_NODES; i++) {
+        h = lval_hash(v->cell[i], h, nodes);
+      }
+      break;
+    case LVAL_VEC:
+      *nodes += v->count;
+      for (int i = 0; i < v->count && *nodes <= LMEMO_MAX_NODES; i++) {
+        h = (h ^ (unsigned long)v->vec[i]) * 1099511628211UL;
+      }
+      break;
+    case LVAL_SEQ: h = (h ^ (unsigned long)v->seq) * 1099511628211UL; break;
+    case LVAL_FUT: h = (h ^ (unsigned long)v->fut) * 1099511628211UL; break;
+  }
+  return h;
+}
+
+/* Structural equality */
+int lval_eq(lval* x, lval* y) {
+  if (x->type != y->type) { return 0; }
+  switch (x->type) {
+    case LVAL_NUM: return x->num == y->num;
+    case LVAL_FUN: return x->fun == y->fun && x->closure == y->closure;
+    case LVAL_ERR: return strcmp(x->err, y->err) == 0;
+    case LVAL_SYM: return x->sym == y->sym;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (x->count != y->count) { return 0; }
+      for (int i = 0; i < x->count; i++) {
+        if (!lval_eq(x->cell[i], y->cell[i])) { return 0; }
+      }
+      return 1;
+    case LVAL_VEC:
+      return x->count == y->count
+          && memcmp(x->vec, y->vec, sizeof(long) * x->count) == 0;
+    case LVAL_SEQ: return x->seq == y->seq;
+    case LVAL_FUT: return x->fut == y->fut;
+  }
+  return 0;
+}
+
+void lmemo_unlink(lmemo_entry* m) {
+  if (m->newer) { m->newer->older = m->older; } else { lmemo.newest = m->older; }
+  if (m->older) { m->older->newer = m->newer; } else { lmemo.oldest = m->newer; }
+}
+
+void lmemo_push(lmemo_entry* m) {
+  m->newer = NULL;
+  m->older = lmemo.newest;
+  if (lmemo.newest) { lmemo.newest->newer = m; } else { lmemo.oldest = m; }
+  lmemo.newest = m;
+}
+
+/* Drop every entry, e.g. when a builtin is rebound */
+void lmemo_clear(void) {
+  for (int i = 0; i < lmemo.used; i++) {
+    lval_del(lmemo.entries[i].args);
+    lval_del(lmemo.entries[i].result);
+  }
+  memset(lmemo.buckets, 0, sizeof(lmemo.buckets));
+  lmemo.used = 0;
+  lmemo.newest = lmemo.oldest = NULL;
+}
+
+/* Frees each thread's entries when it exits */
+pthread_key_t lmemo_key;
+pthread_once_t lmemo_key_once = PTHREAD_ONCE_INIT;
+
+void lmemo_exit(void* unused) { lmemo_clear(); }
+void lmemo_key_init(void) { pthread_key_create(&lmemo_key, lmemo_exit); }
+
+/* Call f on the args a, answering from the cache where possible */
+/* Consumes a, like the builtin itself would */
+lval* lmemo_call(lenv* e, lbuiltin f, lval* a) {
+  if (!lmemo.registered) {
+    pthread_once(&lmemo_key_once, lmemo_key_init);
+    pthread_setspecific(lmemo_key, &lmemo);
+    lmemo.registered = 1;
+  }
+
+  long gen = __atomic_load_n(&lmemo_generation, __ATOMIC_ACQUIRE);
+  if (lmemo.generation != gen) {
+    lmemo_clear();
+    lmemo.generation = gen;
+  }
+
+  int nodes = 0;
+  unsigned long h = lval_hash(a, (unsigned long)f * 1099511628211UL, &nodes);
+  if (nodes > LMEMO_MAX_NODES) { return f(e, a); }
+
+  lmemo_entry** bucket = &lmemo.buckets[h % LMEMO_BUCKETS];
+  for (lmemo_entry* m = *bucket; m; m = m->next) {
+    if (m->hash == h && m->fun == f && lval_eq(m->args, a)) {
+      lmemo.hits++;
+      lmemo_unlink(m);
+      lmemo_push(m);
+      lval_del(a);
+      return lval_copy(m->result);
+    }
+  }
+
+  lmemo.misses++;
+  lval* key = lval_copy(a);
+  lval* result = f(e, a);
+  /* errors are cheap to recompute and shouldn't crowd out results */
+  if (result->type == LVAL_ERR) { lval_del(key); return result; }
+
+  /* take a fresh slot, or recycle the least recently used one */
+  lmemo_entry* m;
+  if (lmemo.used < LMEMO_SIZE) {
+    m = &lmemo.entries[lmemo.used++];
+  } else {
+    m = lmemo.oldest;
+    lmemo_unlink(m);
+    lmemo_entry** p = &lmemo.buckets[m->hash % LMEMO_BUCKETS];
+    while (*p != m) { p = &(*p)->next; }
+    *p = m->next;
+    lval_del(m->args);
+    lval_del(m->result);
+  }
+
+  m->hash = h;
+  m->fun = f;
+  m->args = key;
+  m->result = lval_copy(result);
+  m->next = *bucket;
+  *bucket = m;
+  lmemo_push(m);
+  return result;
+}
+
+/* ENVIRONMENT */
 
 /* Constructor */
 lenv* lenv_new(void) {
   lenv* e = malloc(sizeof(lenv));
+  e->par = NULL;
   e->count = 0;
   e->syms = NULL;
   e->vals = NULL;
+  e->closure = NULL;
+  e->shared = 0;
   return e;
 }
 
 /* Destructor */
 void lenv_del(lenv* e) {
   for (int i = 0; i < e->count; i++) {
-    free(e->syms[i]);
     lval_del(e->vals[i]);
   }
   free(e->syms);
@@ -263,24 +853,63 @@ void lenv_del(lenv* e) {
   free(e);
 }
 
-/* Getter */
-lval* lenv_get(lenv* e, lval* k) {
+/* Look a symbol up in this scope only, not its parents */
+/* Names are interned, so comparing pointers is enough */
+lval* lenv_lookup_local(lenv* e, char* sym) {
   for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      return lval_copy(e->vals[i]);
+    if (e->syms[i] == sym) {
+      return e->vals[i];
     }
   }
-  return lval_err("unbound symbol!");
+  return NULL;
+}
+
+/* Borrowing getter - returns the stored lval itself, or NULL if unbound */
+lval* lenv_lookup(lenv* e, lval* k) {
+  for (; e; e = e->par) {
+    lval* v = lenv_lookup_local(e, k->sym);
+    if (v) { return v; }
+  }
+  return NULL;
+}
+
+/* The global scope, where def binds: the outermost scope, or the one */
+/* just over a shared scope, which is left as it is */
+lenv* lenv_root(lenv* e) {
+  while (e->par && !e->par->shared) { e = e->par; }
+  return e;
+}
+
+/* Getter */
+lval* lenv_get(lenv* e, lval* k) {
+  lval* v = lenv_lookup(e, k);
+  return v ? lval_copy(v) : lval_err("unbound symbol!");
 }
 
-/* Setter */
-void lenv_put(lenv* e, lval* k, lval* v) {
+/* Bumped on every put, so analyses of what names mean can be cached */
+long lenv_generation = 0;
+
+/* Bumped whenever a builtin's binding is replaced, which invalidates */
+/* every call site lval_infer has marked */
+long lbuiltin_generation = 0;
+
+/* Setter: binds the interned name sym to v itself, rather than a copy */
+void lenv_set(lenv* e, char* sym, lval* v) {
+  __atomic_add_fetch(&lenv_generation, 1, __ATOMIC_RELEASE);
+
   /* first check if variable already exists */
   for (int i = 0; i < e->count; i++) {
     /* if found, delete and replace with new val */
-    if (strcmp(e->syms[i], k->sym) == 0) {
+    if (e->syms[i] == sym) {
+      /* cached results may be keyed on the builtin being replaced */
+      if (e->vals[i]->type == LVAL_FUN) {
+        __atomic_add_fetch(&lmemo_generation, 1, __ATOMIC_RELEASE);
+      }
+      if (e->vals[i]->type == LVAL_FUN && e->vals[i]->fun) {
+        __atomic_add_fetch(&lbuiltin_generation, 1, __ATOMIC_RELEASE);
+      }
       lval_del(e->vals[i]);
-      e->vals[i] = lval_copy(v);
+      e->vals[i] = v;
       return;
     }
   }
@@ -290,10 +919,22 @@ void lenv_put(lenv* e, lval* k, lval* v) {
   e->vals = realloc(e->vals, sizeof(lval*) * e->count);
   e->syms = realloc(e->syms, sizeof(char*) * e->count);
 
-  /* copy key and value */
-  e->vals[e->count-1] = lval_copy(v);
-  e->syms[e->count-1] = malloc(strlen(k->sym) + 1);
-  strcpy(e->syms[e->count-1], k->sym);
+  e->vals[e->count-1] = v;
+  e->syms[e->count-1] = sym;
+}
+
+/* Bind k to a copy of v */
+void lenv_put(lenv* e, lval* k, lval* v) { lenv_set(e, k->sym, lval_copy(v)); }
+
+/* A flat copy of every binding visible from e, inner scopes winning */
+lenv* lenv_snapshot(lenv* e) {
+  lenv* x = e->par ? lenv_snapshot(e->par) : lenv_new();
+  for (int i = 0; i < e->count; i++) {
+    lval* k = lval_sym(e->syms[i]);
+    lenv_put(x, k, e->vals[i]);
+    lval_del(k);
+  }
+  return x;
 }
 
 /* READ */
@@ -317,25 +958,26 @@ lval* lval_add(lval* v, lval* x) {
   return v;
 }
 
-lval* lval_read(mpc_ast_t* t) {
-  /* Symbols and Numbers are straightforward */
-  if (strstr(t->tag, "number")) { return lval_read_num(t); }
-  if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+/* Grammar rules, numbered by their position in the mpca_lang call in */
+/* lgrammar_init, which tags each AST node with its innermost rule */
+enum { LRULE_NONE, LRULE_NUMBER, LRULE_SYMBOL, LRULE_SEXPR, LRULE_QEXPR,
+       LRULE_EXPR, LRULE_BLISP };
 
-  /* if root (>) or sexpr or qexpr then first create empty list */
-  lval* x = NULL;
-  if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
-  if (strstr(t->tag, "sexpr")) { x = lval_sexpr(); }
-  if (strstr(t->tag, "qexpr")) { x = lval_qexpr(); }
+lval* lval_read(mpc_ast_t* t) {
+  lval* x;
+  switch (t->rule) {
+    /* Symbols and Numbers are straightforward */
+    case LRULE_NUMBER: return lval_read_num(t);
+    case LRULE_SYMBOL: return lval_sym(t->contents);
+    case LRULE_QEXPR: x = lval_qexpr(); break;
+    /* sexpr, or the root (>), which no rule tags */
+    default: x = lval_sexpr(); break;
+  }
 
   /* Fill the list with any valid expression therein */
   for (int i = 0; i < t->children_num; i++) {
-    /* First, skip the junk */
-    if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
-    if (strcmp(t->children[i]->tag, "regex") == 0) { continue; }
+    /* brackets and the ^ $ regexes match no named rule */
+    if (t->children[i]->rule == LRULE_NONE) { continue; }
 
     x = lval_add(x, lval_read(t->children[i]));
   }
@@ -343,91 +985,2261 @@ lval* lval_read(mpc_ast_t* t) {
   return x;
 }
 
-/* EVAL */
-
-lval* lval_eval(lenv* e, lval* a);
+/* A single pass reader building lvals straight from the source, without */
+/* an mpc_ast_t in between. It accepts exactly what the grammar does, and */
+/* returns NULL for anything else so the caller can fall back to mpc for */
+/* the error message */
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
-  /* Evaluate children */
-  for (int i = 0; i < v->count; i++) {
-    v->cell[i] = lval_eval(e, v->cell[i]);
-  }
+/* Character classes, following the grammar's regexes */
+#define LREAD_SPACE 1
+#define LREAD_DIGIT 2
+#define LREAD_SYM   4
+#define LREAD_BRACKET 8
 
-  /* Error checking */
-  for (int i = 0; i < v->count; i++) {
-    if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
-  }
+const unsigned char lread_class[256] = {
+  [' '] = LREAD_SPACE, ['\f'] = LREAD_SPACE, ['\n'] = LREAD_SPACE,
+  ['\r'] = LREAD_SPACE, ['\t'] = LREAD_SPACE, ['\v'] = LREAD_SPACE,
+  ['0' ... '9'] = LREAD_DIGIT | LREAD_SYM,
+  ['a' ... 'z'] = LREAD_SYM, ['A' ... 'Z'] = LREAD_SYM,
+  ['_'] = LREAD_SYM, ['+'] = LREAD_SYM, ['-'] = LREAD_SYM, ['*'] = LREAD_SYM,
+  ['/'] = LREAD_SYM, ['\\'] = LREAD_SYM, ['='] = LREAD_SYM, ['<'] = LREAD_SYM,
+  ['>'] = LREAD_SYM, ['!'] = LREAD_SYM, ['&'] = LREAD_SYM,
+  ['('] = LREAD_BRACKET, [')'] = LREAD_BRACKET, ['{'] = LREAD_BRACKET, ['}'] = LREAD_BRACKET,
+};
 
-  /* Empty expression */
-  if (v->count == 0) { return v; }
+/* A structural index of the source, built 64 bytes at a time: which */
+/* bytes start a token (brackets, the first of a run of symbol chars, */
+/* and anything the grammar doesn't allow) and which are symbol chars, */
+/* a bit per byte. The reader jumps from one start to the next and to */
+/* the end of each run rather than looking at every byte in between */
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-  /* Single expression */
-  if (v->count == 1) { return lval_take(v, 0); }
+/* One block's classes, a bit per byte */
+typedef struct {
+  uint64_t space;
+  uint64_t bracket;
+  uint64_t sym;
+} lindex_masks;
 
-  /* ensure first element is a function */
-  lval* f = lval_pop(v, 0);
-  if (f->type != LVAL_FUN) {
-    lval_del(v); lval_del(f);
-    return lval_err("first element is not a function!");
+void lindex_classify_scalar(const char* p, lindex_masks* m) {
+  m->space = m->bracket = m->sym = 0;
+  for (int i = 0; i < 64; i++) {
+    unsigned char c = lread_class[(unsigned char)p[i]];
+    if (c & LREAD_SPACE)   { m->space |= 1ULL << i; }
+    if (c & LREAD_BRACKET) { m->bracket |= 1ULL << i; }
+    if (c & LREAD_SYM)     { m->sym |= 1ULL << i; }
   }
-
-  /* if it's a function, call it! */
-  lval* result = f->fun(e, v);
-  lval_del(f);
-  return result;
 }
 
-lval* lval_eval(lenv* e, lval* v) {
-  if (v->type == LVAL_SYM) {
-    lval* x = lenv_get(e, v);
-    lval_del(v);
-    return x;
-  }
+#if defined(__SSE2__)
+/* bytes of v in lo..hi, by shifting the range down to the bottom of */
+/* the signed ones, as SSE2 only compares signed */
+#define LINDEX_RANGE(v, lo, hi) \
+  _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - (lo)))), \
+                 _mm_set1_epi8((char)(-128 + (hi) - (lo) + 1)))
+#define LINDEX_EQ(v, c) _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
 
-  if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
-  /* otherwise there's nothing to do! */
-  return v;
+void lindex_classify_sse2(const char* p, lindex_masks* m) {
+  m->space = m->bracket = m->sym = 0;
+  for (int k = 0; k < 4; k++) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+    __m128i space = _mm_or_si128(LINDEX_EQ(v, ' '), LINDEX_RANGE(v, '\t', '\r'));
+    __m128i bracket = _mm_or_si128(_mm_or_si128(LINDEX_EQ(v, '('), LINDEX_EQ(v, ')')),
+                                   _mm_or_si128(LINDEX_EQ(v, '{'), LINDEX_EQ(v, '}')));
+    /* letters either case, digits, < = > and * +, then the rest singly */
+    __m128i sym = _mm_or_si128(LINDEX_RANGE(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'),
+                               LINDEX_RANGE(v, '0', '9'));
+    sym = _mm_or_si128(sym, _mm_or_si128(LINDEX_RANGE(v, '<', '>'), LINDEX_RANGE(v, '*', '+')));
+    sym = _mm_or_si128(sym, _mm_or_si128(LINDEX_EQ(v, '!'), LINDEX_EQ(v, '&')));
+    sym = _mm_or_si128(sym, _mm_or_si128(LINDEX_EQ(v, '-'), LINDEX_EQ(v, '/')));
+    sym = _mm_or_si128(sym, _mm_or_si128(LINDEX_EQ(v, '\\'), LINDEX_EQ(v, '_')));
+    m->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << 16 * k;
+    m->bracket |= (uint64_t)(uint16_t)_mm_movemask_epi8(bracket) << 16 * k;
+    m->sym |= (uint64_t)(uint16_t)_mm_movemask_epi8(sym) << 16 * k;
+  }
 }
 
-/* BUILTINS */
+/* With AVX2, classes come from looking up each byte's low and high */
+/* nibble in a table apiece and and-ing the two: each bit stands for a */
+/* block of the ASCII table, the bytes whose nibbles are both in its */
+/* sets. Bits 0-1 are whitespace (\t-\r, then space) and 2-6 symbol */
+/* chars (! & * + - /, then digits and < = >, A-O and a-o, P-Z and p-z, */
+/* \ and _). Brackets are just compared for */
+__attribute__((target("avx2")))
+void lindex_classify_avx2(const char* p, lindex_masks* m) {
+  const __m256i lo = _mm256_setr_epi8(
+    0x2A, 0x3C, 0x38, 0x38, 0x38, 0x38, 0x3C, 0x38, 0x38, 0x39, 0x35, 0x15, 0x59, 0x1D, 0x18, 0x54,
+    0x2A, 0x3C, 0x38, 0x38, 0x38, 0x38, 0x3C, 0x38, 0x38, 0x39, 0x35, 0x15, 0x59, 0x1D, 0x18, 0x54);
+  const __m256i hi = _mm256_setr_epi8(
+    0x01, 0x00, 0x06, 0x08, 0x10, 0x60, 0x10, 0x20, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x01, 0x00, 0x06, 0x08, 0x10, 0x60, 0x10, 0x20, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i zero = _mm256_setzero_si256();
+  m->space = m->bracket = m->sym = 0;
+  for (int k = 0; k < 2; k++) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(p + 32 * k));
+    __m256i c = _mm256_and_si256(
+      _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble)),
+      _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+    __m256i space = _mm256_cmpeq_epi8(_mm256_and_si256(c, _mm256_set1_epi8(0x03)), zero);
+    __m256i sym = _mm256_cmpeq_epi8(_mm256_and_si256(c, _mm256_set1_epi8(0x7C)), zero);
+    __m256i bracket = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('(')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')'))),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}'))));
+    m->space |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(space) << 32 * k;
+    m->sym |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(sym) << 32 * k;
+    m->bracket |= (uint64_t)(uint32_t)_mm256_movemask_epi8(bracket) << 32 * k;
+  }
+}
+#endif
 
-lval* builtin_head(lenv* e, lval* a) {
-  /* Check for error conditions */
-  LASSERT_ARG_NUM(a, 1);
-  LASSERT_TYPE(a, LVAL_QEXPR);
-  LASSERT_EMPTY_LIST(a);
+/* The classifier for this CPU, picked the first time anything is read */
+void (*lindex_classify)(const char*, lindex_masks*) = lindex_classify_scalar;
+pthread_once_t lindex_once = PTHREAD_ONCE_INIT;
 
-  /* If no error, take the first arg */
-  lval* v = lval_take(a, 0);
-  /* Delete all elements that are not the head */
-  while (v->count > 1) { lval_del(lval_pop(v, 1)); }
-  return v;
+void lindex_init(void) {
+#if defined(__SSE2__)
+  lindex_classify = __builtin_cpu_supports("avx2") ? lindex_classify_avx2 : lindex_classify_sse2;
+#endif
 }
 
-lval* builtin_tail(lenv* e, lval* a) {
-  /* Check for error conditions */
-  LASSERT_ARG_NUM(a, 1);
-  LASSERT_TYPE(a, LVAL_QEXPR);
-  LASSERT_EMPTY_LIST(a);
+typedef struct {
+  const char* src;
+  size_t len;
+  /* offset of the block last classified, and its masks */
+  size_t base;
+  uint64_t sym;
+  uint64_t starts;
+  uint64_t bracket;
+} lindex;
 
-  /* If no error, take the first arg */
-  lval* v = lval_take(a, 0);
-  /* Delete the first element and return */
-  lval_del(lval_pop(v, 0));
-  return v;
+void lindex_load(lindex* x, size_t base) {
+  lindex_masks m;
+  if (x->len - base >= 64) {
+    lindex_classify(x->src + base, &m);
+  } else {
+    /* the last, short block, padded out with spaces */
+    char block[64];
+    memset(block, ' ', 64);
+    memcpy(block, x->src + base, x->len - base);
+    lindex_classify(block, &m);
+  }
+  /* whether a run of symbol chars carries on from the block before */
+  uint64_t carry = base > 0 && lread_class[(unsigned char)x->src[base - 1]] & LREAD_SYM;
+  x->base = base;
+  x->sym = m.sym;
+  x->bracket = m.bracket;
+  x->starts = m.bracket | ~(m.space | m.bracket | m.sym) | (m.sym & ~(m.sym << 1 | carry));
 }
 
-/* Simply convert the given Sexpr to a Qexpr */
-/* Not unlike 'quote' */
-lval* builtin_list(lenv* e, lval* a) {
-  a->type = LVAL_QEXPR;
-  return a;
+/* The first token start at or after i, or len if there's none */
+size_t lindex_next(lindex* x, size_t i) {
+  while (i < x->len) {
+    size_t base = i & ~(size_t)63;
+    if (base != x->base) { lindex_load(x, base); }
+    uint64_t starts = x->starts >> (i & 63);
+    if (starts) { return i + __builtin_ctzll(starts); }
+    i = base + 64;
+  }
+  return x->len;
 }
 
-lval* builtin_eval(lenv* e, lval* a) {
-  LASSERT_ARG_NUM(a, 1);
-  LASSERT_TYPE(a, LVAL_QEXPR);
+/* The end of the run of symbol chars at i */
+size_t lindex_run_end(lindex* x, size_t i) {
+  while (i < x->len) {
+    size_t base = i & ~(size_t)63;
+    if (base != x->base) { lindex_load(x, base); }
+    uint64_t other = ~x->sym >> (i & 63);
+    if (other) {
+      i += __builtin_ctzll(other);
+      return i < x->len ? i : x->len;
+    }
+    i = base + 64;
+  }
+  return x->len;
+}
 
+/* The end of the top-level form starting at i, found as lstream_form */
+/* finds it, by counting brackets - but only looking at the brackets */
+size_t lindex_form_end(lindex* x, size_t i) {
+  unsigned char c = x->src[i];
+  if (lread_class[c] & LREAD_SYM) { return lindex_run_end(x, i); }
+  if (c != '(' && c != '{') { return i + 1; }
+  int depth = 0;
+  while (i < x->len) {
+    size_t base = i & ~(size_t)63;
+    if (base != x->base) { lindex_load(x, base); }
+    uint64_t brackets = x->bracket >> (i & 63);
+    if (!brackets) { i = base + 64; continue; }
+    i += __builtin_ctzll(brackets);
+    c = x->src[i++];
+    if (c == '(' || c == '{') { depth++; } else if (--depth == 0) { return i; }
+  }
+  return x->len;
+}
+
+/* Read the number -?[0-9]+ at *s, as strtol would */
+lval* lval_read_num_src(const char** s, const char* end) {
+  const char* p = *s;
+  int neg = *p == '-';
+  if (neg) { p++; }
+  /* count down, so LONG_MIN fits */
+  long x = 0;
+  int range = 1;
+  for (; p < end && lread_class[(unsigned char)*p] & LREAD_DIGIT; p++) {
+    int d = *p - '0';
+    if (x < (LONG_MIN + d) / 10) { range = 0; }
+    else { x = x * 10 - d; }
+  }
+  if (!neg && x == LONG_MIN) { range = 0; }
+  *s = p;
+  if (!range) { return lval_err("invalid number"); }
+  return lval_num(neg ? x : -x);
+}
+
+/* Add x to a list being read, whose cells have room for *room. Past a */
+/* few cells they grow by doubling, as lval_add's one at a time turns */
+/* into a copy or a remap per cell once a list is large */
+void lval_read_add(lval* v, int* room, lval* x) {
+  if (v->count == *room) {
+    *room = *room < 8 ? *room + 1 : *room * 2;
+    v->cell = realloc(v->cell, sizeof(lval*) * *room);
+  }
+  v->cell[v->count++] = x;
+}
+
+/* Read the len bytes at src, which needn't be NUL terminated. Tokens are */
+/* read where they lie, and only a symbol's first sighting is copied */
+lval* lval_read_src(const char* src, size_t len) {
+  pthread_once(&lindex_once, lindex_init);
+
+  /* the lists still open, innermost last, under the root */
+  int depth = 0;
+  int cap = 16;
+  lval** open = malloc(sizeof(lval*) * cap);
+  int* room = malloc(sizeof(int) * cap);
+  open[0] = lval_sexpr();
+  room[0] = 0;
+
+  lindex index = { src, len, SIZE_MAX, 0, 0, 0 };
+  size_t i = lindex_next(&index, 0);
+  while (i < len) {
+    unsigned char c = src[i];
+    if (lread_class[c] & LREAD_SYM) {
+      /* a run of symbol chars: numbers, as many as there are, and then */
+      /* a symbol taking up whatever's left */
+      const char* p = src + i;
+      const char* end = src + lindex_run_end(&index, i);
+      while (p < end) {
+        lval* x;
+        if (lread_class[(unsigned char)*p] & LREAD_DIGIT
+            || (*p == '-' && p + 1 < end && lread_class[(unsigned char)p[1]] & LREAD_DIGIT)) {
+          x = lval_read_num_src(&p, end);
+        } else {
+          x = lval_sym(lsym_intern_len(p, end - p));
+          p = end;
+        }
+        lval_read_add(open[depth], &room[depth], x);
+      }
+      i = lindex_next(&index, end - src);
+      continue;
+    }
+
+    if (c == '(' || c == '{') {
+      if (++depth == cap) {
+        cap *= 2;
+        open = realloc(open, sizeof(lval*) * cap);
+        room = realloc(room, sizeof(int) * cap);
+      }
+      open[depth] = c == '(' ? lval_sexpr() : lval_qexpr();
+      room[depth] = 0;
+    } else if ((c == ')' || c == '}') && depth > 0
+               && open[depth]->type == (c == ')' ? LVAL_SEXPR : LVAL_QEXPR)) {
+      lval* x = open[depth--];
+      lval_read_add(open[depth], &room[depth], x);
+    } else {
+      break;
+    }
+    i = lindex_next(&index, i + 1);
+  }
+
+  /* stopped early, or with lists left open */
+  if (i < len || depth > 0) {
+    for (int i = depth; i >= 0; i--) { lval_del(open[i]); }
+    free(open);
+    free(room);
+    return NULL;
+  }
+
+  lval* root = open[0];
+  free(open);
+  free(room);
+  return root;
+}
+
+/* Top-level forms taken one at a time from a stream, for running files */
+/* without holding all of them. Regular files are mapped whole and read */
+/* where they lie. Anything else is read into a buffer that only grows to */
+/* fit the largest form. Either way each form is handed out in place */
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LSTREAM_CHUNK 65536
+
+typedef struct {
+  FILE* in;
+  char* buf;
+  size_t cap;
+  /* set if buf is the mapped file rather than malloc'd */
+  int mapped;
+  /* bytes read so far, and the end of the form last handed out */
+  size_t end;
+  size_t pos;
+  /* how much of the mapping has been handed back */
+  size_t released;
+  /* errno of a failed read, or 0 */
+  int err;
+  /* where pos is in the stream, and where the form last handed out began */
+  long row;
+  long col;
+  long form_row;
+  long form_col;
+} lstream;
+
+void lstream_init(lstream* s, FILE* in) {
+  s->in = in;
+  s->end = 0;
+  s->pos = 0;
+  s->released = 0;
+  s->err = 0;
+  s->row = 0;
+  s->col = 0;
+
+  int fd = fileno(in);
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+      && lseek(fd, 0, SEEK_CUR) == 0) {
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      s->buf = map;
+      s->cap = s->end = st.st_size;
+      s->mapped = 1;
+      return;
+    }
+  }
+
+  s->cap = LSTREAM_CHUNK;
+  s->buf = malloc(s->cap);
+  s->mapped = 0;
+}
+
+void lstream_free(lstream* s) {
+  if (s->mapped) { munmap(s->buf, s->cap); } else { free(s->buf); }
+}
+
+/* Read more of the stream onto the end of buf, returning 0 at its end */
+/* read(2) rather than fread, so forms arriving down a pipe are */
+/* evaluated as soon as they're complete */
+int lstream_more(lstream* s) {
+  if (s->mapped) { return 0; }
+  if (s->cap - s->end < LSTREAM_CHUNK / 2) {
+    s->cap *= 2;
+    s->buf = realloc(s->buf, s->cap);
+  }
+  while (1) {
+    ssize_t n = read(fileno(s->in), s->buf + s->end, s->cap - s->end);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n < 0) { s->err = errno; }
+    if (n <= 0) { return 0; }
+    s->end += n;
+    return 1;
+  }
+}
+
+/* Forget everything before pos */
+void lstream_drop(lstream* s) {
+  if (!s->mapped) {
+    /* only once it's half the buffer, so each byte moves O(1) times */
+    if (s->pos < s->cap / 2) { return; }
+    memmove(s->buf, s->buf + s->pos, s->end - s->pos);
+    s->end -= s->pos;
+    s->pos = 0;
+    return;
+  }
+  /* unmap pages already read now and then, so they don't count */
+  /* against the resident set; they stay in the page cache */
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t done = s->pos / page * page;
+  if (done - s->released >= 256 * page) {
+    madvise(s->buf + s->released, done - s->released, MADV_DONTNEED);
+    s->released = done;
+  }
+}
+
+/* The next top-level form, setting len to its length, or NULL at the */
+/* stream's end. The form is only brought to an end here, with brackets */
+/* just counted; anything malformed is left for the reader to reject */
+char* lstream_form(lstream* s, size_t* len) {
+  lstream_drop(s);
+
+  /* skip to its start */
+  while (1) {
+    if (s->pos == s->end && !lstream_more(s)) { return NULL; }
+    char c = s->buf[s->pos];
+    if (!(lread_class[(unsigned char)c] & LREAD_SPACE)) { break; }
+    s->pos++;
+    if (c == '\n') { s->row++; s->col = 0; } else { s->col++; }
+  }
+  s->form_row = s->row;
+  s->form_col = s->col;
+
+  /* and take it up to its end: the closing bracket, or the end of an atom */
+  size_t i = s->pos;
+  int depth = 0;
+  do {
+    if (i == s->end && !lstream_more(s)) { break; }
+    unsigned char c = s->buf[i++];
+    if (c == '(' || c == '{') { depth++; }
+    else if (c == ')' || c == '}') { depth--; }
+    else if (depth == 0 && lread_class[c] & LREAD_SYM) {
+      while ((i < s->end || lstream_more(s))
+             && lread_class[(unsigned char)s->buf[i]] & LREAD_SYM) { i++; }
+    }
+  } while (depth > 0);
+
+  char* form = s->buf + s->pos;
+  *len = i - s->pos;
+  for (; s->pos < i; s->pos++) {
+    if (s->buf[s->pos] == '\n') { s->row++; s->col = 0; } else { s->col++; }
+  }
+  return form;
+}
+
+/* POOL */
+
+/* A work-stealing scheduler: each worker owns a Chase-Lev deque, pushing */
+/* and popping tasks at the bottom while idle workers steal from the top */
+
+lval* lval_eval(lenv* e, lval* a);
+
+/* Evaluate v in e; done is set once result is */
+typedef struct ltask {
+  lenv* e;
+  lval* v;
+  lval* result;
+  int done;
+  /* if set, called with the task instead of evaluating v */
+  void (*run)(struct ltask* t);
+  void* arg;
+} ltask;
+
+/* A power of two, so indices can wrap with a mask */
+#define LDEQUE_SIZE 1024
+#define LPOOL_MAX_THREADS 64
+
+typedef struct ldeque {
+  long top;
+  long bottom;
+  ltask* buf[LDEQUE_SIZE];
+} ldeque;
+
+struct {
+  int threads;
+  int stop;
+  pthread_t ids[LPOOL_MAX_THREADS];
+  ldeque deques[LPOOL_MAX_THREADS];
+  /* tasks pushed but not yet taken, and workers waiting for one */
+  long pending;
+  int sleepers;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+} lpool = { .threads = 1, .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+/* Index of this thread's deque - the thread that starts the pool is */
+/* worker 0, threads outside the pool have none and never fork */
+__thread int lworker = -1;
+
+int ldeque_size(ldeque* d) {
+  return (int)(__atomic_load_n(&d->bottom, __ATOMIC_RELAXED)
+             - __atomic_load_n(&d->top, __ATOMIC_RELAXED));
+}
+
+/* Owner only - returns 0 if the deque is full */
+int ldeque_push(ldeque* d, ltask* t) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  if (b - top >= LDEQUE_SIZE) { return 0; }
+  __atomic_store_n(&d->buf[b & (LDEQUE_SIZE - 1)], t, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/* Owner only */
+ltask* ldeque_pop(ldeque* d) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+  if (t > b) {
+    /* empty */
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  ltask* x = __atomic_load_n(&d->buf[b & (LDEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+  if (t == b) {
+    /* last one - race thieves for it */
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      x = NULL;
+    }
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return x;
+}
+
+/* Any thread */
+ltask* ldeque_steal(ldeque* d) {
+  long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+  if (t >= b) { return NULL; }
+
+  ltask* x = __atomic_load_n(&d->buf[t & (LDEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+  return x;
+}
+
+void ltask_run(ltask* t) {
+  __atomic_sub_fetch(&lpool.pending, 1, __ATOMIC_SEQ_CST);
+  if (t->run) { t->run(t); } else { t->result = lval_eval(t->e, t->v); }
+  __atomic_store_n(&t->done, 1, __ATOMIC_RELEASE);
+}
+
+/* Take a task from our own deque, or failing that someone else's */
+ltask* lpool_find(void) {
+  ltask* t = ldeque_pop(&lpool.deques[lworker]);
+  for (int i = 1; !t && i < lpool.threads; i++) {
+    t = ldeque_steal(&lpool.deques[(lworker + i) % lpool.threads]);
+  }
+  return t;
+}
+
+/* Schedule t to be evaluated, returning 0 if it should run inline instead */
+int lpool_fork(ltask* t) {
+  t->done = 0;
+  if (lworker < 0 || !ldeque_push(&lpool.deques[lworker], t)) { return 0; }
+  __atomic_add_fetch(&lpool.pending, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&lpool.sleepers, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&lpool.lock);
+    pthread_cond_signal(&lpool.wake);
+    pthread_mutex_unlock(&lpool.lock);
+  }
+  return 1;
+}
+
+/* Wait for a forked task, running other tasks in the meantime */
+lval* lpool_join(ltask* t) {
+  while (!__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+    ltask* other = lpool_find();
+    if (other) { ltask_run(other); } else { sched_yield(); }
+  }
+  return t->result;
+}
+
+void* lpool_worker(void* arg) {
+  lworker = (int)(long)arg;
+  int idle = 0;
+  while (!__atomic_load_n(&lpool.stop, __ATOMIC_ACQUIRE)) {
+    ltask* t = lpool_find();
+    if (t) { ltask_run(t); idle = 0; continue; }
+    if (++idle < 64) { sched_yield(); continue; }
+
+    /* nothing to steal for a while, so park until something is pushed */
+    pthread_mutex_lock(&lpool.lock);
+    __atomic_add_fetch(&lpool.sleepers, 1, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n(&lpool.pending, __ATOMIC_SEQ_CST)
+           && !__atomic_load_n(&lpool.stop, __ATOMIC_ACQUIRE)) {
+      pthread_cond_wait(&lpool.wake, &lpool.lock);
+    }
+    __atomic_sub_fetch(&lpool.sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&lpool.lock);
+    idle = 0;
+  }
+  return NULL;
+}
+
+/* Start n - 1 workers to go with the calling thread */
+void lpool_start(int n) {
+  if (n > LPOOL_MAX_THREADS) { n = LPOOL_MAX_THREADS; }
+  lpool.threads = n;
+  lworker = 0;
+  for (int i = 1; i < n; i++) {
+    pthread_create(&lpool.ids[i], NULL, lpool_worker, (void*)(long)i);
+  }
+}
+
+void lpool_stop(void) {
+  pthread_mutex_lock(&lpool.lock);
+  __atomic_store_n(&lpool.stop, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&lpool.wake);
+  pthread_mutex_unlock(&lpool.lock);
+  for (int i = 1; i < lpool.threads; i++) { pthread_join(lpool.ids[i], NULL); }
+  lpool.threads = 1;
+}
+
+/* COROUTINES */
+
+/* Stackful coroutines for generators. Each runs on its own mmap'd stack */
+/* with a guard page at the bottom; the stack is only reserved, so pages */
+/* are committed as the coroutine first touches them and a shallow */
+/* producer costs a few KB however big the reservation is */
+
+#include <ucontext.h>
+
+#define LCORO_STACK (8 * 1024 * 1024)
+#define LCORO_GUARD 4096
+/* finished stacks kept per thread for the next coroutine */
+#define LCORO_CACHE 4
+
+typedef struct lcoro {
+  ucontext_t ctx;
+  ucontext_t caller;
+  char* stack;
+  void (*run)(void* arg);
+  void* arg;
+  /* the coroutine that resumed this one, if any */
+  struct lcoro* prev;
+  /* while preempted, the innermost coroutine running on top of this one */
+  struct lcoro* top;
+  int done;
+  /* set to make the body unwind, see lval_eval_sexpr */
+  int cancelled;
+} lcoro;
+
+/* The coroutine running on this thread, NULL on a thread's own stack */
+__thread lcoro* lcoro_current = NULL;
+
+__thread struct {
+  int registered;
+  int count;
+  char* stacks[LCORO_CACHE];
+} lcoro_cache;
+
+/* Unmaps each thread's cached stacks when it exits */
+pthread_key_t lcoro_key;
+pthread_once_t lcoro_key_once = PTHREAD_ONCE_INIT;
+
+void lcoro_exit(void* unused) {
+  while (lcoro_cache.count) { munmap(lcoro_cache.stacks[--lcoro_cache.count], LCORO_STACK); }
+}
+void lcoro_key_init(void) { pthread_key_create(&lcoro_key, lcoro_exit); }
+
+void lcoro_entry(void) {
+  lcoro* co = lcoro_current;
+  co->run(co->arg);
+  co->done = 1;
+  swapcontext(&co->ctx, &co->caller);
+}
+
+/* A coroutine that calls run(arg) when first resumed, NULL if out of memory */
+lcoro* lcoro_new(void (*run)(void*), void* arg) {
+  char* stack;
+  if (lcoro_cache.count) {
+    stack = lcoro_cache.stacks[--lcoro_cache.count];
+  } else {
+    stack = mmap(NULL, LCORO_STACK, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED) { return NULL; }
+    mprotect(stack, LCORO_GUARD, PROT_NONE);
+  }
+
+  lcoro* co = calloc(1, sizeof(lcoro));
+  co->stack = stack;
+  co->run = run;
+  co->arg = arg;
+  getcontext(&co->ctx);
+  co->ctx.uc_stack.ss_sp = stack + LCORO_GUARD;
+  co->ctx.uc_stack.ss_size = LCORO_STACK - LCORO_GUARD;
+  co->ctx.uc_link = NULL;
+  makecontext(&co->ctx, lcoro_entry, 0);
+  return co;
+}
+
+/* Only once it's done - a suspended body still has lvals on its stack */
+void lcoro_del(lcoro* co) {
+  if (!lcoro_cache.registered) {
+    pthread_once(&lcoro_key_once, lcoro_key_init);
+    pthread_setspecific(lcoro_key, &lcoro_cache);
+    lcoro_cache.registered = 1;
+  }
+  if (lcoro_cache.count < LCORO_CACHE) {
+    lcoro_cache.stacks[lcoro_cache.count++] = co->stack;
+  } else {
+    munmap(co->stack, LCORO_STACK);
+  }
+  free(co);
+}
+
+/* Run co until it yields or finishes, returning 0 once it has finished */
+/* Coroutines don't fork, or their tasks would sit on this thread's */
+/* deque interleaved with the consumer's across every switch */
+int lcoro_resume(lcoro* co) {
+  int worker = lworker;
+  lworker = -1;
+  co->prev = lcoro_current;
+  /* a preempted coroutine carries on wherever in its chain it stopped */
+  lcoro* to = co->top ? co->top : co;
+  co->top = NULL;
+  lcoro_current = to;
+  swapcontext(&co->caller, &to->ctx);
+  lcoro_current = co->prev;
+  lworker = worker;
+  return !co->done;
+}
+
+/* Back to whoever resumed the running coroutine */
+void lcoro_yield(void) {
+  lcoro* co = lcoro_current;
+  swapcontext(&co->ctx, &co->caller);
+}
+
+/* Suspend the running coroutine and everything under it down to base, */
+/* going straight back to whoever resumed base. Resuming base picks up */
+/* where this left off, even inside a generator base was consuming */
+void lcoro_preempt(lcoro* base) {
+  lcoro* top = lcoro_current;
+  base->top = top;
+  swapcontext(&top->ctx, &base->caller);
+}
+
+/* Time slicing: eval steps and builtin calls each burn a unit of fuel */
+/* Outside a sliced task the tank never runs dry */
+__thread long lfuel = LONG_MAX;
+/* The time-sliced task running on this thread, if any */
+__thread lcoro* lcoro_sliced = NULL;
+
+/* Out of fuel - give up the thread if we're in a sliced task */
+void lfuel_out(void) {
+  if (lcoro_sliced) {
+    lcoro_preempt(lcoro_sliced);
+  } else {
+    lfuel = LONG_MAX;
+  }
+}
+
+/* EVAL */
+
+int lbuiltin_is_pure(lbuiltin f);
+lval* builtin_def(lenv* e, lval* a);
+lval* builtin_if(lenv* e, lval* a);
+lval* lval_call_sexpr(lenv* e, lval* v);
+int lbuiltin_is_lazy(lbuiltin f);
+lval* lseq_force(lenv* e, lval* v);
+
+/* The lval types each code in a builtin's signature accepts */
+const int lsig_mask[128] = {
+  ['n'] = 1 << LVAL_NUM,
+  ['N'] = 1 << LVAL_NUM | 1 << LVAL_VEC,
+  ['q'] = 1 << LVAL_QEXPR,
+  ['v'] = 1 << LVAL_VEC,
+  ['l'] = 1 << LVAL_QEXPR | 1 << LVAL_VEC,
+  ['s'] = 1 << LVAL_QEXPR | 1 << LVAL_VEC | 1 << LVAL_SEQ,
+  ['f'] = 1 << LVAL_FUN,
+  ['u'] = 1 << LVAL_FUT,
+  ['a'] = -1,
+};
+
+/* Check the args a against sig, returning the error if they don't fit */
+/* This is the only arity and type checking builtins get */
+lval* lsig_check(lsig* sig, lval* a) {
+  if (a->count < sig->min) { return lval_err("Function passed too few args!"); }
+  if (sig->max >= 0 && a->count > sig->max) { return lval_err("Function passed too many args!"); }
+  char* t = sig->types;
+  for (int i = 0; i < a->count; i++) {
+    if (!(lsig_mask[(int)*t] & 1 << a->cell[i]->type)) {
+      return lval_err(*t == 'n' || *t == 'N'
+        ? "Cannot operate on non-number!"
+        : "Function called with incorrect type");
+    }
+    if (t[1]) { t++; }
+  }
+  return NULL;
+}
+
+/* Call the builtin f on the args a, consuming a, without checking them */
+lval* lbuiltin_run(lenv* e, lval* f, lval* a) {
+  return lbuiltin_is_pure(f->fun) ? lmemo_call(e, f->fun, a) : f->fun(e, a);
+}
+
+/* Call the builtin f on the args a, consuming a */
+lval* lbuiltin_call(lenv* e, lval* f, lval* a) {
+  lval* err = lsig_check(f->sig, a);
+  if (err) { lval_del(a); return err; }
+  return lbuiltin_run(e, f, a);
+}
+
+/* Checks skipped on call sites lval_infer marked, reported with -d */
+__thread long lsig_skipped = 0;
+
+lval* lval_eval_shared(lenv* e, lval* v);
+lval* lval_eval_shared_sexpr(lenv* e, lval* v);
+
+/* Call a user-defined function, consuming argv[0..argc) but not argv */
+/* The arguments are bound in place as the frame's values, and the body */
+/* is evaluated where it is, so no argument list is built and nothing */
+/* is copied */
+lval* lval_call(lenv* e, lval* f, int argc, lval** argv) {
+  lclosure* c = f->closure;
+  if (argc != c->argc) {
+    for (int i = 0; i < argc; i++) { lval_del(argv[i]); }
+    return lval_err(argc < c->argc
+      ? "Function passed too few args!"
+      : "Function passed too many args!");
+  }
+
+  /* params -> captured variables -> globals */
+  lenv captured = c->captured;
+  captured.par = lenv_root(e);
+  lenv frame = { &captured, argc, c->formals, argv, c };
+
+  lval* result = lval_eval_shared_sexpr(&frame, c->body);
+  for (int i = 0; i < argc; i++) { lval_del(argv[i]); }
+  return result;
+}
+
+/* Call any function on argv[0..argc), consuming the args */
+lval* lval_apply(lenv* e, lval* f, int argc, lval** argv) {
+  if (f->type == LVAL_FUN && f->closure) { return lval_call(e, f, argc, argv); }
+
+  lval* a = lval_sexpr();
+  a->count = argc;
+  a->cell = malloc(sizeof(lval*) * argc);
+  memcpy(a->cell, argv, sizeof(lval*) * argc);
+
+  if (f->type != LVAL_FUN) {
+    lval_del(a);
+    return lval_err("first element is not a function!");
+  }
+  lfuel--;
+  return lbuiltin_call(e, f, a);
+}
+
+/* Args cheaper than this are evaluated inline rather than forked */
+#define LPAR_MIN_COST 64
+/* What a call to a user-defined function adds to the estimate */
+#define LPAR_CALL_COST 64
+/* Don't fork while this many of our own tasks are still waiting */
+#define LPAR_MAX_QUEUED 8
+
+/* Rough cost of evaluating v: its node count, plus a flat amount per */
+/* call to a user-defined function. Stops counting at limit */
+int lpar_cost(lenv* e, lval* v, int limit) {
+  if (v->type != LVAL_SEXPR) { return 1; }
+  int cost = 1;
+  if (v->count && v->cell[0]->type == LVAL_SYM) {
+    lval* f = lenv_lookup(e, v->cell[0]);
+    if (f && f->type == LVAL_FUN && f->closure) { cost += LPAR_CALL_COST; }
+  }
+  for (int i = 0; i < v->count && cost < limit; i++) {
+    cost += lpar_cost(e, v->cell[i], limit - cost);
+  }
+  return cost;
+}
+
+/* The closures a query is in the middle of checking, innermost first */
+typedef struct lpar_visit {
+  lclosure* c;
+  /* how far down the chain this one is */
+  int level;
+  /* the outermost closure whose answer this one's depends on */
+  int low;
+  struct lpar_visit* up;
+} lpar_visit;
+
+int lpar_safe_closure(lenv* e, lclosure* c, int depth, lpar_visit* in);
+
+/* Whether evaluating v can't write to the environment: no symbol it */
+/* mentions, or that anything it mentions mentions, is bound to def */
+/* Unbound symbols are taken to be locals. in is NULL but for the */
+/* checks of the closures lpar_safe_closure is looking into */
+int lpar_safe(lenv* e, lval* v, int depth, lpar_visit* in) {
+  if (depth > 16) { return 0; }
+  switch (v->type) {
+    case LVAL_SYM: {
+      lval* x = lenv_lookup(e, v);
+      if (!x) { return 1; }
+      if (x->type == LVAL_FUN && x->fun == builtin_def) { return 0; }
+      if (x->type == LVAL_FUN && x->closure) { return lpar_safe_closure(e, x->closure, depth + 1, in); }
+      /* e.g. a Qexpr that might be eval'd */
+      return x->type == LVAL_SYM || x->type == LVAL_SEXPR || x->type == LVAL_QEXPR
+        ? lpar_safe(e, x, depth + 1, in) : 1;
+    }
+    case LVAL_FUN:
+      return v->fun != builtin_def && (!v->closure || lpar_safe_closure(e, v->closure, depth + 1, in));
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < v->count; i++) {
+        if (!lpar_safe(e, v->cell[i], depth, in)) { return 0; }
+      }
+      return 1;
+  }
+  return 1;
+}
+
+/* Closures cache the answer until the next lenv_put. A closure can be */
+/* shared by contexts with different globals, so it's only good for */
+/* the global scope it was found in */
+int lpar_safe_closure(lenv* e, lclosure* c, int depth, lpar_visit* in) {
+  long gen = __atomic_load_n(&lenv_generation, __ATOMIC_ACQUIRE);
+  lenv* root = lenv_root(e);
+  if (__atomic_load_n(&c->par_gen, __ATOMIC_ACQUIRE) == gen
+      && __atomic_load_n(&c->par_root, __ATOMIC_RELAXED) == root) {
+    return __atomic_load_n(&c->par_safe, __ATOMIC_RELAXED);
+  }
+
+  /* one being checked further up, e.g. on a recursive call, is taken */
+  /* to be safe for now - and so what's found meanwhile only holds */
+  /* within this query, until its own answer is in */
+  for (lpar_visit* x = in; x; x = x->up) {
+    if (x->c != c) { continue; }
+    if (x->level < in->low) { in->low = x->level; }
+    return 1;
+  }
+
+  lpar_visit self = { c, in ? in->level + 1 : 0, INT_MAX, in };
+  int safe = 1;
+  for (int i = 0; i < c->captured.count && safe; i++) {
+    safe = lpar_safe(e, c->captured.vals[i], depth, &self);
+  }
+  if (safe) { safe = lpar_safe(e, c->body, depth, &self); }
+
+  /* unsafe holds whatever was assumed, safe only if nothing further */
+  /* up was, or that will be answered with the outer closure */
+  if (!safe || self.low >= self.level) {
+    __atomic_store_n(&c->par_safe, safe, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->par_root, root, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->par_gen, gen, __ATOMIC_RELEASE);
+  } else if (self.low < in->low) {
+    in->low = self.low;
+  }
+  return safe;
+}
+
+/* Evaluate the children of v into out, forking the expensive ones onto */
+/* the pool. out is v->cell unless v is shared (see lval_eval_shared), */
+/* when v is left as it is and forked children are copies. After an */
+/* error, children not reached are left in place, or in out, empty */
+void lpar_eval_children(lenv* e, lval* v, lval** out) {
+  int shared = out != v->cell;
+  char forked[v->count];
+  int candidates = 0;
+  for (int i = 0; i < v->count; i++) {
+    forked[i] = v->cell[i]->type == LVAL_SEXPR
+      && lpar_cost(e, v->cell[i], LPAR_MIN_COST) >= LPAR_MIN_COST;
+    candidates += forked[i];
+  }
+
+  /* forked args run alongside the inline ones, so all must be safe */
+  int safe = candidates > 0 && ldeque_size(&lpool.deques[lworker]) < LPAR_MAX_QUEUED;
+  for (int i = 0; i < v->count && safe; i++) {
+    if (v->cell[i]->type == LVAL_SEXPR) { safe = lpar_safe(e, v->cell[i], 0, NULL); }
+  }
+  if (!safe) {
+    for (int i = 0, failed = 0; i < v->count; i++) {
+      if (failed) {
+        if (shared) { out[i] = lval_sexpr(); }
+        continue;
+      }
+      out[i] = shared ? lval_eval_shared(e, v->cell[i]) : lval_eval(e, v->cell[i]);
+      failed = out[i]->type == LVAL_ERR;
+    }
+    return;
+  }
+
+  ltask stack[8];
+  ltask* tasks = v->count <= 8 ? stack : malloc(sizeof(ltask) * v->count);
+  for (int i = 0; i < v->count; i++) {
+    if (forked[i]) {
+      tasks[i] = (ltask){ e, shared ? lval_copy(v->cell[i]) : v->cell[i], NULL, 0, NULL, NULL };
+      forked[i] = lpool_fork(&tasks[i]);
+    }
+  }
+
+  /* after an error the rest of the inline args are skipped, though */
+  /* forked ones still have to be waited for */
+  for (int i = 0, failed = 0; i < v->count; i++) {
+    if (forked[i]) { continue; }
+    if (failed) {
+      if (shared) { out[i] = lval_sexpr(); }
+      continue;
+    }
+    out[i] = shared ? lval_eval_shared(e, v->cell[i]) : lval_eval(e, v->cell[i]);
+    failed = out[i]->type == LVAL_ERR;
+  }
+
+  /* newest first, so our own tasks come off the deque in order */
+  for (int i = v->count - 1; i >= 0; i--) {
+    if (forked[i]) { out[i] = lpool_join(&tasks[i]); }
+  }
+
+  if (tasks != stack) { free(tasks); }
+}
+
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+  /* the only safe point - nothing is half done and no lock is held */
+  if (--lfuel < 0) { lfuel_out(); }
+
+  /* a generator whose consumer has stopped, or a task being freed, */
+  /* unwinds without going on */
+  if (lcoro_current && lcoro_current->cancelled) {
+    lval_del(v);
+    return lval_err("Evaluation cancelled");
+  }
+
+  /* Evaluate children, stopping at the first error - lval_take frees */
+  /* the args evaluated so far and the ones never reached in one go */
+  if (lpool.threads > 1 && lworker >= 0 && v->count > 2) {
+    lpar_eval_children(e, v, v->cell);
+    for (int i = 0; i < v->count; i++) {
+      if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    }
+  } else {
+    for (int i = 0; i < v->count; i++) {
+      v->cell[i] = lval_eval(e, v->cell[i]);
+      if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    }
+  }
+  return lval_call_sexpr(e, v);
+}
+
+/* Call the evaluated sexpr v, consuming it */
+lval* lval_call_sexpr(lenv* e, lval* v) {
+  /* Empty expression */
+  if (v->count == 0) { return v; }
+
+  /* user-defined functions bind their args straight from the cells */
+  /* a lone function is only called if it takes no args */
+  lval* head = v->cell[0];
+  if (head->type == LVAL_FUN && head->closure
+      && (v->count > 1 || head->closure->argc == 0)) {
+    lval* f = v->cell[0];
+    lval* result = lval_call(e, f, v->count - 1, v->cell + 1);
+    lval_del(f);
+    free(v->cell);
+    free(v);
+    return result;
+  }
+
+  /* Single expression */
+  if (v->count == 1) { return lval_take(v, 0); }
+
+  /* ensure first element is a function */
+  lval* f = lval_pop(v, 0);
+  if (f->type != LVAL_FUN) {
+    lval_del(v); lval_del(f);
+    return lval_err("first element is not a function!");
+  }
+
+  /* most builtins see sequences as the Qexprs they stand for */
+  if (!lbuiltin_is_lazy(f->fun)) {
+    for (int i = 0; i < v->count; i++) {
+      if (v->cell[i]->type != LVAL_SEQ) { continue; }
+      v->cell[i] = lseq_force(e, v->cell[i]);
+      if (v->cell[i]->type == LVAL_ERR) { lval_del(f); return lval_take(v, i); }
+    }
+  }
+
+  /* if it's a function, call it! */
+  lfuel--;
+  lval* result;
+  if (v->typed == f->sig
+      && v->typed_gen == __atomic_load_n(&lbuiltin_generation, __ATOMIC_ACQUIRE)) {
+    lsig_skipped++;
+    result = lbuiltin_run(e, f, v);
+  } else {
+    result = lbuiltin_call(e, f, v);
+  }
+  lval_del(f);
+  return result;
+}
+
+/* Delete cells[0..n) but for the one at keep, which is returned */
+lval* lval_keep(lval** cells, int n, int keep) {
+  for (int i = 0; i < n; i++) {
+    if (i != keep) { lval_del(cells[i]); }
+  }
+  return cells[keep];
+}
+
+/* Evaluate the list v as lval_eval_sexpr would a copy of it, leaving v */
+/* as it is, for the body of a closure, which every call shares. An if */
+/* whose branches are written out evaluates only the branch taken, and */
+/* a call with at most three args keeps them on the stack */
+lval* lval_eval_shared_sexpr(lenv* e, lval* v) {
+  if (--lfuel < 0) { lfuel_out(); }
+  if (lcoro_current && lcoro_current->cancelled) { return lval_err("Evaluation cancelled"); }
+
+  int n = v->count;
+  if (n == 0) { return lval_sexpr(); }
+
+  if (n == 4 && v->cell[0]->type == LVAL_SYM
+      && v->cell[2]->type == LVAL_QEXPR && v->cell[3]->type == LVAL_QEXPR) {
+    lval* f = lval_eval_shared(e, v->cell[0]);
+    int is_if = f->type == LVAL_FUN && f->fun == builtin_if;
+    lval_del(f);
+    if (is_if) {
+      lval* cond = lval_eval_shared(e, v->cell[1]);
+      if (cond->type == LVAL_ERR) { return cond; }
+      /* what lsig_check says of anything else */
+      int num = cond->type == LVAL_NUM, taken = num && cond->num;
+      lval_del(cond);
+      if (!num) { return lval_err("Cannot operate on non-number!"); }
+      lfuel--;
+      return lval_eval_shared_sexpr(e, v->cell[taken ? 2 : 3]);
+    }
+  }
+
+  lval* stack[4];
+  lval** cells = n <= 4 ? stack : malloc(sizeof(lval*) * n);
+  lval* err = NULL;
+  if (lpool.threads > 1 && lworker >= 0 && n > 2) {
+    lpar_eval_children(e, v, cells);
+    for (int i = 0; i < n && !err; i++) {
+      if (cells[i]->type == LVAL_ERR) { err = lval_keep(cells, n, i); }
+    }
+  } else {
+    for (int i = 0; i < n && !err; i++) {
+      cells[i] = lval_eval_shared(e, v->cell[i]);
+      if (cells[i]->type == LVAL_ERR) { err = lval_keep(cells, i + 1, i); }
+    }
+  }
+  if (err) {
+    if (cells != stack) { free(cells); }
+    return err;
+  }
+
+  lval* head = cells[0];
+  if (head->type == LVAL_FUN && head->closure && (n > 1 || head->closure->argc == 0)) {
+    lval* result = lval_call(e, head, n - 1, cells + 1);
+    lval_del(head);
+    if (cells != stack) { free(cells); }
+    return result;
+  }
+
+  /* anything else is called as an sexpr of its own */
+  lval* a = lval_sexpr();
+  a->count = n;
+  a->cell = cells;
+  if (cells == stack) {
+    a->cell = malloc(sizeof(lval*) * n);
+    memcpy(a->cell, stack, sizeof(lval*) * n);
+  }
+  a->typed = v->typed;
+  a->typed_gen = v->typed_gen;
+  return lval_call_sexpr(e, a);
+}
+
+/* Evaluate v without consuming it, see lval_eval_shared_sexpr */
+lval* lval_eval_shared(lenv* e, lval* v) {
+  if (v->type == LVAL_SYM) {
+    /* a formal or captured variable of the closure being called */
+    if (v->slot_in && v->slot_in == e->closure) {
+      return lval_copy(v->slot < e->count ? e->vals[v->slot] : e->par->vals[v->slot - e->count]);
+    }
+    return lenv_get(e, v);
+  }
+  if (v->type == LVAL_SEXPR) { return lval_eval_shared_sexpr(e, v); }
+  return lval_copy(v);
+}
+
+lval* lval_eval(lenv* e, lval* v) {
+  if (v->type == LVAL_SYM) {
+    lval* x = lenv_get(e, v);
+    lval_del(v);
+    return x;
+  }
+
+  if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
+  /* otherwise there's nothing to do! */
+  return v;
+}
+
+/* REDUCE */
+
+/* Variadic +, max and min over many args gather the numbers into a flat */
+/* buffer and reduce it with SSE2 or AVX2 kernels, picked on first use */
+
+/* Below this many args the gather costs more than it saves */
+#define LREDUCE_MIN 16
+
+/* Each kernel stores the reduction of xs[0..n) in out, returning 0 */
+/* if the exact result doesn't fit in a long */
+typedef int (*lreduce_kernel)(const long* xs, int n, long* out);
+
+/* Counting the net number of times the running sum wraps tells us */
+/* whether the exact sum fits, however the intermediate sums overflow */
+int lsum_scalar(const long* xs, int n, long* out) {
+  long x = 0;
+  int carry = 0;
+  for (int i = 0; i < n; i++) {
+    if (__builtin_add_overflow(x, xs[i], &x)) { carry += xs[i] > 0 ? 1 : -1; }
+  }
+  *out = x;
+  return carry == 0;
+}
+
+int lmax_scalar(const long* xs, int n, long* out) {
+  long x = xs[0];
+  for (int i = 1; i < n; i++) { if (xs[i] > x) { x = xs[i]; } }
+  *out = x;
+  return 1;
+}
+
+int lmin_scalar(const long* xs, int n, long* out) {
+  long x = xs[0];
+  for (int i = 1; i < n; i++) { if (xs[i] < x) { x = xs[i]; } }
+  *out = x;
+  return 1;
+}
+
+/* Finish off a vector sum: the lanes hold exact partial sums as long as */
+/* none of them overflowed, so the total is lanes + tail */
+int lsum_lanes(const long* lanes, int nlanes, long overflow,
+               const long* tail, int ntail, long* out) {
+  if (overflow < 0) { return -1; }
+  long buf[4 + 4];
+  int n = 0;
+  for (int i = 0; i < nlanes; i++) { buf[n++] = lanes[i]; }
+  for (int i = 0; i < ntail; i++) { buf[n++] = tail[i]; }
+  return lsum_scalar(buf, n, out);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+/* SSE2 is part of x86-64, so this needs no check */
+int lsum_sse2(const long* xs, int n, long* out) {
+  __m128i acc = _mm_setzero_si128();
+  __m128i ovf = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(xs + i));
+    __m128i s = _mm_add_epi64(acc, x);
+    /* signed overflow iff both inputs differ in sign from the result */
+    ovf = _mm_or_si128(ovf, _mm_and_si128(_mm_xor_si128(acc, s), _mm_xor_si128(x, s)));
+    acc = s;
+  }
+  long lanes[2], flags[2];
+  _mm_storeu_si128((__m128i*)lanes, acc);
+  _mm_storeu_si128((__m128i*)flags, ovf);
+  int r = lsum_lanes(lanes, 2, flags[0] | flags[1], xs + i, n - i, out);
+  return r < 0 ? lsum_scalar(xs, n, out) : r;
+}
+
+__attribute__((target("avx2")))
+int lsum_avx2(const long* xs, int n, long* out) {
+  __m256i acc = _mm256_setzero_si256();
+  __m256i ovf = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(xs + i));
+    __m256i s = _mm256_add_epi64(acc, x);
+    ovf = _mm256_or_si256(ovf, _mm256_and_si256(_mm256_xor_si256(acc, s), _mm256_xor_si256(x, s)));
+    acc = s;
+  }
+  long lanes[4], flags[4];
+  _mm256_storeu_si256((__m256i*)lanes, acc);
+  _mm256_storeu_si256((__m256i*)flags, ovf);
+  int r = lsum_lanes(lanes, 4, flags[0] | flags[1] | flags[2] | flags[3], xs + i, n - i, out);
+  return r < 0 ? lsum_scalar(xs, n, out) : r;
+}
+
+/* SSE2 has no 64-bit compare, so min and max need AVX2 to vectorize */
+__attribute__((target("avx2")))
+int lmax_avx2(const long* xs, int n, long* out) {
+  if (n < 4) { return lmax_scalar(xs, n, out); }
+  __m256i m = _mm256_loadu_si256((const __m256i*)xs);
+  int i = 4;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(xs + i));
+    m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(x, m));
+  }
+  long lanes[4 + 4];
+  _mm256_storeu_si256((__m256i*)lanes, m);
+  int k = 4;
+  for (; i < n; i++) { lanes[k++] = xs[i]; }
+  return lmax_scalar(lanes, k, out);
+}
+
+__attribute__((target("avx2")))
+int lmin_avx2(const long* xs, int n, long* out) {
+  if (n < 4) { return lmin_scalar(xs, n, out); }
+  __m256i m = _mm256_loadu_si256((const __m256i*)xs);
+  int i = 4;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(xs + i));
+    m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(m, x));
+  }
+  long lanes[4 + 4];
+  _mm256_storeu_si256((__m256i*)lanes, m);
+  int k = 4;
+  for (; i < n; i++) { lanes[k++] = xs[i]; }
+  return lmin_scalar(lanes, k, out);
+}
+#endif
+
+int lsum_resolve(const long* xs, int n, long* out);
+int lmax_resolve(const long* xs, int n, long* out);
+int lmin_resolve(const long* xs, int n, long* out);
+
+/* Start out pointing at resolvers, which swap in the best kernel */
+lreduce_kernel lsum = lsum_resolve;
+lreduce_kernel lmax = lmax_resolve;
+lreduce_kernel lmin = lmin_resolve;
+
+void lreduce_select(void) {
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    lsum = lsum_avx2; lmax = lmax_avx2; lmin = lmin_avx2;
+    return;
+  }
+  lsum = lsum_sse2; lmax = lmax_scalar; lmin = lmin_scalar;
+#else
+  lsum = lsum_scalar; lmax = lmax_scalar; lmin = lmin_scalar;
+#endif
+}
+
+int lsum_resolve(const long* xs, int n, long* out) { lreduce_select(); return lsum(xs, n, out); }
+int lmax_resolve(const long* xs, int n, long* out) { lreduce_select(); return lmax(xs, n, out); }
+int lmin_resolve(const long* xs, int n, long* out) { lreduce_select(); return lmin(xs, n, out); }
+
+/* Reduce the all-number args a with k, consuming a */
+lval* lreduce_op(lval* a, lreduce_kernel k) {
+  long* xs = malloc(sizeof(long) * a->count);
+  for (int i = 0; i < a->count; i++) { xs[i] = a->cell[i]->num; }
+
+  long x;
+  int ok = k(xs, a->count, &x);
+  free(xs);
+  lval_del(a);
+  return ok ? lval_num(x) : lval_err("Integer overflow!");
+}
+
+/* VECTORS */
+
+/* Elementwise arithmetic over LVAL_VEC, broadcasting scalar operands */
+
+enum { LVEC_ADD, LVEC_SUB, LVEC_MUL, LVEC_DIV, LVEC_MIN, LVEC_MAX };
+
+/* Plain loops over restrict pointers, which the compiler vectorizes; on */
+/* x86-64 an AVX2 clone is built alongside and picked at load time */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define LVEC_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define LVEC_KERNEL
+#endif
+
+/* Run body for each element with a = x[i] and b = y[i], or b = s if y is NULL */
+#define LVEC_LOOP(body) \
+  if (y) { for (int i = 0; i < n; i++) { long a = x[i], b = y[i]; body } } \
+  else   { for (int i = 0; i < n; i++) { long a = x[i], b = s;    body } }
+
+/* x[i] = x[i] op y[i] in place, returning nonzero if a division */
+/* overflowed - the other ops wrap. Additions count the net number of */
+/* times each lane wrapped in carry[i], as lsum_scalar does, so a */
+/* lane only overflows if its exact sum doesn't fit */
+LVEC_KERNEL
+int lvec_apply(int op, long* restrict x, const long* restrict y, long s,
+               long* restrict carry, int n) {
+  unsigned long ovf = 0;
+  switch (op) {
+    /* add unsigned to wrap without UB, then check signs like lsum_sse2: */
+    /* a wrap is -1 after the shift, and counts as b's sign */
+    case LVEC_ADD:
+      LVEC_LOOP(long r = (long)((unsigned long)a + (unsigned long)b);
+                carry[i] += ((a ^ r) & (b ^ r)) >> 63 & (b >> 63 | 1);
+                x[i] = r;)
+      break;
+    case LVEC_SUB: LVEC_LOOP(x[i] = (long)((unsigned long)a - (unsigned long)b);) break;
+    case LVEC_MUL: LVEC_LOOP(x[i] = (long)((unsigned long)a * (unsigned long)b);) break;
+    /* LONG_MIN / -1 traps, so -1 negates instead, as the scalar / */
+    /* reports an overflow for it */
+    case LVEC_DIV:
+      LVEC_LOOP(if (b == -1) {
+                  ovf |= (unsigned long)(a == LONG_MIN) << 63;
+                  x[i] = (long)(0UL - (unsigned long)a);
+                } else {
+                  x[i] = a / b;
+                })
+      break;
+    case LVEC_MIN: LVEC_LOOP(x[i] = a < b ? a : b;) break;
+    case LVEC_MAX: LVEC_LOOP(x[i] = a > b ? a : b;) break;
+  }
+  return ovf >> 63;
+}
+
+/* Fold the args of an arithmetic builtin left to right, elementwise */
+/* At least one arg is a vector, the rest may be numbers */
+lval* lvec_op(lval* a, char* op) {
+  int k = -1;
+  if (strcmp(op, "+") == 0 || strcmp(op, "add") == 0) { k = LVEC_ADD; }
+  if (strcmp(op, "-") == 0 || strcmp(op, "sub") == 0) { k = LVEC_SUB; }
+  if (strcmp(op, "*") == 0 || strcmp(op, "mul") == 0) { k = LVEC_MUL; }
+  if (strcmp(op, "/") == 0 || strcmp(op, "div") == 0) { k = LVEC_DIV; }
+  if (strcmp(op, "min") == 0) { k = LVEC_MIN; }
+  if (strcmp(op, "max") == 0) { k = LVEC_MAX; }
+  LASSERT(a, k >= 0, "Cannot operate on vector!");
+
+  int n = -1;
+  for (int i = 0; i < a->count; i++) {
+    lval* y = a->cell[i];
+    if (y->type != LVAL_VEC) { continue; }
+    LASSERT(a, n < 0 || y->count == n, "Vector length mismatch!");
+    n = y->count;
+    if (k == LVEC_DIV && i > 0) {
+      for (int j = 0; j < n; j++) { LASSERT(a, y->vec[j] != 0, "Division By Zero!"); }
+    }
+  }
+
+  /* the accumulator is the first arg, broadcast if it's a number */
+  lval* x = lval_pop(a, 0);
+  if (x->type == LVAL_NUM) {
+    lval* b = lval_vec(n);
+    for (int i = 0; i < n; i++) { b->vec[i] = x->num; }
+    lval_del(x);
+    x = b;
+  }
+
+  /* unary minus negates */
+  if (k == LVEC_SUB && a->count == 0) {
+    for (int i = 0; i < n; i++) { x->vec[i] = (long)(0UL - (unsigned long)x->vec[i]); }
+  }
+
+  int ovf = 0;
+  long* carry = k == LVEC_ADD ? calloc(n ? n : 1, sizeof(long)) : NULL;
+  for (int i = 0; i < a->count; i++) {
+    lval* y = a->cell[i];
+    if (y->type == LVAL_NUM && k == LVEC_DIV && y->num == 0) {
+      lval_del(x); lval_del(a);
+      return lval_err("Division By Zero!");
+    }
+    ovf |= y->type == LVAL_VEC
+      ? lvec_apply(k, x->vec, y->vec, 0, carry, n)
+      : lvec_apply(k, x->vec, NULL, y->num, carry, n);
+  }
+  for (int i = 0; carry && i < n; i++) { ovf |= carry[i] != 0; }
+  free(carry);
+
+  lval_del(a);
+  if (ovf) { lval_del(x); return lval_err("Integer overflow!"); }
+  return x;
+}
+
+/* The elements [from, to) of the vector in a, consuming a */
+lval* lvec_slice(lval* a, int from, int to) {
+  lval* v = lval_take(a, 0);
+  LASSERT(v, v->count != 0, "Function called on empty list");
+  lval* x = lval_vec(to - from);
+  memcpy(x->vec, v->vec + from, sizeof(long) * (to - from));
+  lval_del(v);
+  return x;
+}
+
+/* (vec {nums...}) */
+lval* builtin_vec(lenv* e, lval* a) {
+  lval* q = a->cell[0];
+  for (int i = 0; i < q->count; i++) {
+    LASSERT(a, q->cell[i]->type == LVAL_NUM, "Cannot operate on non-number!");
+  }
+
+  lval* x = lval_vec(q->count);
+  for (int i = 0; i < q->count; i++) { x->vec[i] = q->cell[i]->num; }
+  lval_del(a);
+  return x;
+}
+
+/* (unvec [nums...]) back to a Qexpr */
+lval* builtin_unvec(lenv* e, lval* a) {
+  lval* v = a->cell[0];
+
+  lval* x = lval_qexpr();
+  x->count = v->count;
+  x->cell = malloc(sizeof(lval*) * v->count);
+  for (int i = 0; i < v->count; i++) { x->cell[i] = lval_num(v->vec[i]); }
+  lval_del(a);
+  return x;
+}
+
+/* SEQUENCES */
+
+/* map, filter and take build lazy pipelines, which run in one fused pass */
+/* when forced into a Qexpr or consumed by reduce. No stage materializes */
+/* its output, each element goes through every stage before the next */
+
+lseq* lseq_new(int kind, lseq* up) {
+  lseq* s = calloc(1, sizeof(lseq));
+  s->refs = 1;
+  s->kind = kind;
+  s->up = up;
+  return s;
+}
+
+/* Anything map and friends accept as input, as a sequence node */
+/* Consumes v, returns NULL if it isn't a sequence, Qexpr or vector */
+lseq* lseq_of(lval* v) {
+  if (v->type == LVAL_SEQ) {
+    lseq* s = v->seq;
+    __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+    lval_del(v);
+    return s;
+  }
+  if (v->type != LVAL_QEXPR && v->type != LVAL_VEC) { lval_del(v); return NULL; }
+  lseq* s = lseq_new(LSEQ_LIST, NULL);
+  s->list = v;
+  return s;
+}
+
+/* One pass over a generator: its body calls f, on a coroutine that */
+/* switches back to the pipeline with each value it yields */
+typedef struct lgen {
+  lcoro* co;
+  lenv* e;
+  lval* f;
+  lval* out;
+  lval* result;
+} lgen;
+
+void lgen_body(void* arg) {
+  lgen* g = arg;
+  g->result = lval_apply(g->e, g->f, 0, NULL);
+}
+
+#define LSEQ_MAX_STAGES 64
+
+/* Run the pipeline s, passing each element that comes out the end to */
+/* reduce (acc x) if f is given, or appending it to the Qexpr acc if not */
+/* Consumes acc, returns the final accumulator or an error */
+lval* lseq_run(lenv* e, lseq* s, lval* f, lval* acc) {
+  /* flatten the chain into source + stages, in the order they apply */
+  lseq* stages[LSEQ_MAX_STAGES];
+  long taken[LSEQ_MAX_STAGES];
+  int n = 0;
+  for (; s->up; s = s->up) {
+    if (n == LSEQ_MAX_STAGES) { lval_del(acc); return lval_err("Sequence pipeline too long!"); }
+    stages[n++] = s;
+  }
+  for (int i = 0, j = n - 1; i < j; i++, j--) {
+    lseq* t = stages[i]; stages[i] = stages[j]; stages[j] = t;
+  }
+
+  int done = 0;
+  for (int k = 0; k < n; k++) {
+    taken[k] = 0;
+    if (stages[k]->kind == LSEQ_TAKE && stages[k]->n <= 0) { done = 1; }
+  }
+
+  lgen gen = { NULL, e, s->f, NULL, NULL };
+  if (s->kind == LSEQ_GEN && !(gen.co = lcoro_new(lgen_body, &gen))) {
+    lval_del(acc);
+    return lval_err("Could not start generator!");
+  }
+
+  long len = s->kind == LSEQ_LIST ? s->list->count : 0;
+  long i = s->kind == LSEQ_RANGE ? s->from : 0;
+  lval* err = NULL;
+  /* a range's next step went past the end of a long, so past to too */
+  int stepped_out = 0;
+  while (!done && !err) {
+    lval* x;
+    if (s->kind == LSEQ_RANGE) {
+      if (stepped_out || (s->step > 0 ? i >= s->to : i <= s->to)) { break; }
+      x = lval_num(i);
+      stepped_out = __builtin_add_overflow(i, s->step, &i);
+    } else if (s->kind == LSEQ_GEN) {
+      if (!lcoro_resume(gen.co)) { break; }
+      x = gen.out;
+      gen.out = NULL;
+    } else {
+      if (i >= len) { break; }
+      x = s->list->type == LVAL_VEC ? lval_num(s->list->vec[i]) : lval_copy(s->list->cell[i]);
+      i++;
+    }
+
+    for (int k = 0; k < n && x; k++) {
+      lseq* st = stages[k];
+      switch (st->kind) {
+        case LSEQ_MAP:
+          x = lval_apply(e, st->f, 1, &x);
+          if (x->type == LVAL_ERR) { err = x; x = NULL; }
+          break;
+        case LSEQ_FILTER: {
+          lval* arg = lval_copy(x);
+          lval* keep = lval_apply(e, st->f, 1, &arg);
+          if (keep->type == LVAL_ERR) { lval_del(x); x = NULL; err = keep; break; }
+          if (keep->type != LVAL_NUM || keep->num == 0) { lval_del(x); x = NULL; }
+          lval_del(keep);
+          break;
+        }
+        case LSEQ_TAKE:
+          /* nothing gets past a full take, so the whole pass can stop */
+          if (++taken[k] >= st->n) { done = 1; }
+          break;
+      }
+    }
+    if (!x) { continue; }
+
+    if (f) {
+      lval* args[2] = { acc, x };
+      acc = lval_apply(e, f, 2, args);
+      if (acc->type == LVAL_ERR) { err = acc; acc = NULL; }
+    } else {
+      lval_add(acc, x);
+    }
+  }
+
+  if (gen.co) {
+    if (!gen.co->done) {
+      /* stopped early, so have the body unwind rather than finish */
+      gen.co->cancelled = 1;
+      while (lcoro_resume(gen.co)) { lval_del(gen.out); gen.out = NULL; }
+      lval_del(gen.result);
+    } else if (gen.result->type == LVAL_ERR && !err) {
+      err = gen.result;
+    } else {
+      lval_del(gen.result);
+    }
+    lcoro_del(gen.co);
+  }
+
+  if (err) {
+    if (acc) { lval_del(acc); }
+    return err;
+  }
+  return acc;
+}
+
+/* Materialize a sequence as a Qexpr, consuming it */
+lval* lseq_force(lenv* e, lval* v) {
+  lval* x = lseq_run(e, v->seq, NULL, lval_qexpr());
+  lval_del(v);
+  return x;
+}
+
+/* (range to), (range from to) or (range from to step) */
+lval* builtin_range(lenv* e, lval* a) {
+  LASSERT(a, a->count < 3 || a->cell[2]->num != 0, "Range step cannot be zero!");
+
+  lseq* s = lseq_new(LSEQ_RANGE, NULL);
+  s->from = a->count > 1 ? a->cell[0]->num : 0;
+  s->to = a->count > 1 ? a->cell[1]->num : a->cell[0]->num;
+  s->step = a->count > 2 ? a->cell[2]->num : 1;
+  lval_del(a);
+  return lval_seq(s);
+}
+
+/* map and filter: (stage f xs) */
+lval* lseq_stage(lval* a, int kind) {
+  lval* f = lval_pop(a, 0);
+  lseq* up = lseq_of(lval_take(a, 0));
+  lseq* s = lseq_new(kind, up);
+  s->f = f;
+  return lval_seq(s);
+}
+
+/* (gen f) is the sequence of what f yields when called with no args */
+/* Each pass over it calls f afresh */
+lval* builtin_gen(lenv* e, lval* a) {
+  lseq* s = lseq_new(LSEQ_GEN, NULL);
+  s->f = lval_take(a, 0);
+  return lval_seq(s);
+}
+
+/* (yield x) hands x on from inside a generator, returning () once the */
+/* pipeline wants the next value */
+lval* builtin_yield(lenv* e, lval* a) {
+  LASSERT(a, lcoro_current && lcoro_current->run == lgen_body,
+    "yield used outside a generator!");
+  LASSERT(a, !lcoro_current->cancelled, "Generator closed");
+
+  lgen* g = lcoro_current->arg;
+  g->out = lval_take(a, 0);
+  lcoro_yield();
+  if (lcoro_current->cancelled) { return lval_err("Generator closed"); }
+  return lval_sexpr();
+}
+
+lval* builtin_map(lenv* e, lval* a) { return lseq_stage(a, LSEQ_MAP); }
+lval* builtin_filter(lenv* e, lval* a) { return lseq_stage(a, LSEQ_FILTER); }
+
+/* (take n xs) */
+lval* builtin_take(lenv* e, lval* a) {
+  long n = a->cell[0]->num;
+  lseq* up = lseq_of(lval_pop(a, 1));
+  lval_del(a);
+
+  lseq* s = lseq_new(LSEQ_TAKE, up);
+  s->n = n;
+  return lval_seq(s);
+}
+
+/* (reduce f init xs) */
+lval* builtin_reduce(lenv* e, lval* a) {
+  lval* f = lval_pop(a, 0);
+  lval* acc = lval_pop(a, 0);
+  lseq* s = lseq_of(lval_take(a, 0));
+
+  lval* x = lseq_run(e, s, f, acc);
+  lseq_del(s);
+  lval_del(f);
+  return x;
+}
+
+/* PARALLEL */
+
+/* pmap and preduce split a list into chunks that run on the pool */
+
+int lbuiltin_is_commutative(lbuiltin f);
+lval* builtin_add(lenv* e, lval* a);
+
+/* One chunk's slice of the input, and where its results go */
+typedef struct lchunk {
+  lval* f;
+  lval** in;
+  int n;
+  /* pmap: one result per input, preduce: just the one */
+  lval** out;
+  /* preduce with +: the exact sum, and the least and greatest running sum */
+  __int128 sum, lo, hi;
+} lchunk;
+
+void lchunk_map(ltask* t) {
+  lchunk* c = t->arg;
+  for (int i = 0; i < c->n; i++) {
+    c->out[i] = lval_apply(t->e, c->f, 1, &c->in[i]);
+  }
+}
+
+/* Fold a chunk starting from its own first element */
+void lchunk_reduce(ltask* t) {
+  lchunk* c = t->arg;
+  lval* acc = c->in[0];
+  for (int i = 1; i < c->n; i++) {
+    if (acc->type == LVAL_ERR) { lval_del(c->in[i]); continue; }
+    lval* args[2] = { acc, c->in[i] };
+    acc = lval_apply(t->e, c->f, 2, args);
+  }
+  c->out[0] = acc;
+}
+
+/* Add up a chunk of numbers exactly. (+ acc x) fails as soon as a */
+/* running sum overflows, so the range the running sums cover is kept */
+/* too, to find out whether any sum reduce would see overflows */
+void lchunk_sum(ltask* t) {
+  lchunk* c = t->arg;
+  __int128 sum = 0, lo = 0, hi = 0;
+  for (int i = 0; i < c->n; i++) {
+    sum += c->in[i]->num;
+    if (sum < lo) { lo = sum; }
+    if (sum > hi) { hi = sum; }
+    lval_del(c->in[i]);
+  }
+  c->sum = sum; c->lo = lo; c->hi = hi;
+  c->out[0] = NULL;
+}
+
+/* Run run over xs in chunks of about size, forking all but the first */
+/* onto the pool, or running them all here if f isn't safe to share. */
+/* Consumes the elements of xs, writing results to out. Returns the */
+/* chunks, for the caller to free, in case run left anything in them */
+lchunk* lchunk_run(lenv* e, lval* f, lval* xs, int size, int per_chunk_out,
+                   void (*run)(ltask* t), lval** out) {
+  int n = xs->count;
+  if (size <= 0) { size = n / (lpool.threads * 4) + 1; }
+  int chunks = (n + size - 1) / size;
+
+  lchunk* cs = malloc(sizeof(lchunk) * (chunks ? chunks : 1));
+  ltask* ts = malloc(sizeof(ltask) * (chunks ? chunks : 1));
+  int parallel = lpool.threads > 1 && lworker >= 0 && lpar_safe(e, f, 0, NULL);
+
+  for (int i = 0; i < chunks; i++) {
+    int from = i * size;
+    cs[i] = (lchunk){ f, xs->cell + from, n - from < size ? n - from : size,
+                      out + (per_chunk_out ? from : i), 0, 0, 0 };
+    ts[i] = (ltask){ e, NULL, NULL, 0, run, &cs[i] };
+  }
+
+  /* fork the rest, work on the first, then help until they're done */
+  int* forked = calloc(chunks ? chunks : 1, sizeof(int));
+  for (int i = 1; i < chunks && parallel; i++) { forked[i] = lpool_fork(&ts[i]); }
+  for (int i = 0; i < chunks; i++) {
+    if (!forked[i]) { run(&ts[i]); }
+  }
+  for (int i = chunks - 1; i > 0; i--) {
+    if (forked[i]) { lpool_join(&ts[i]); }
+  }
+
+  free(forked);
+  free(ts);
+  return cs;
+}
+
+/* Turn the vector xs in (name f ... xs [chunk]) into a Qexpr */
+lval* lchunk_args(lval* a, int nargs) {
+  lval* xs = a->cell[nargs - 1];
+  if (xs->type == LVAL_VEC) {
+    lval* q = lval_qexpr();
+    q->count = xs->count;
+    q->cell = malloc(sizeof(lval*) * xs->count);
+    for (int i = 0; i < xs->count; i++) { q->cell[i] = lval_num(xs->vec[i]); }
+    lval_del(xs);
+    a->cell[nargs - 1] = xs = q;
+  }
+  return a;
+}
+
+/* (pmap f xs [chunk]) - same result as (map f xs), but eager */
+lval* builtin_pmap(lenv* e, lval* a) {
+  a = lchunk_args(a, 2);
+  if (a->type == LVAL_ERR) { return a; }
+  lval* xs = a->cell[1];
+  int size = a->count > 2 ? (int)a->cell[2]->num : 0;
+
+  lval* out = lval_qexpr();
+  out->count = xs->count;
+  out->cell = malloc(sizeof(lval*) * xs->count);
+  free(lchunk_run(e, a->cell[0], xs, size, 1, lchunk_map, out->cell));
+  /* the elements were consumed by the chunks */
+  xs->count = 0;
+  lval_del(a);
+
+  /* report the first error, as a serial map would */
+  for (int i = 0; i < out->count; i++) {
+    if (out->cell[i]->type == LVAL_ERR) { return lval_take(out, i); }
+  }
+  return out;
+}
+
+/* (preduce f init xs [chunk]) - same as (reduce f init xs). Only a fold */
+/* of numbers by + * min or max is split up: on numbers these can't */
+/* fail, bar + overflowing, and regrouping them can't change the answer. */
+/* Anything else is folded in order from init, as reduce would */
+lval* builtin_preduce(lenv* e, lval* a) {
+  a = lchunk_args(a, 3);
+  if (a->type == LVAL_ERR) { return a; }
+  lval* f = a->cell[0];
+  lval* xs = a->cell[2];
+
+  int split = lpool.threads > 1 && f->fun && lbuiltin_is_commutative(f->fun)
+    && a->cell[1]->type == LVAL_NUM;
+  for (int i = 0; i < xs->count && split; i++) {
+    split = xs->cell[i]->type == LVAL_NUM;
+  }
+  if (!split) {
+    if (a->count > 3) { lval_del(lval_pop(a, 3)); }
+    return builtin_reduce(e, a);
+  }
+
+  int size = a->count > 3 ? (int)a->cell[3]->num : 0;
+  if (size <= 0) { size = xs->count / (lpool.threads * 4) + 1; }
+  int chunks = (xs->count + size - 1) / size;
+
+  lval* parts = lval_qexpr();
+  parts->count = chunks;
+  parts->cell = malloc(sizeof(lval*) * (chunks ? chunks : 1));
+  int sum = f->fun == builtin_add;
+  lchunk* cs = lchunk_run(e, f, xs, size, 0, sum ? lchunk_sum : lchunk_reduce,
+                          parts->cell);
+  xs->count = 0;
+  for (int i = 0; i < chunks && !sum; i++) {
+    if (parts->cell[i]->type == LVAL_ERR) {
+      free(cs); lval_del(a); return lval_take(parts, i);
+    }
+  }
+
+  f = lval_pop(a, 0);
+  lval* acc = lval_pop(a, 0);
+  lval_del(a);
+
+  if (sum) {
+    /* the running sums of each chunk, offset by the sum before it */
+    __int128 x = acc->num;
+    for (int i = 0; i < chunks; i++) {
+      if (x + cs[i].lo < LONG_MIN || x + cs[i].hi > LONG_MAX) {
+        lval_del(acc);
+        acc = lval_err("Integer overflow!");
+        break;
+      }
+      x += cs[i].sum;
+    }
+    if (acc->type == LVAL_NUM) { acc->num = (long)x; }
+    parts->count = 0;
+  }
+  free(cs);
+
+  for (int i = 0; i < parts->count && acc->type != LVAL_ERR; i++) {
+    lval* args[2] = { acc, parts->cell[i] };
+    parts->cell[i] = NULL;
+    acc = lval_apply(e, f, 2, args);
+  }
+  for (int i = 0; i < parts->count; i++) {
+    if (parts->cell[i]) { lval_del(parts->cell[i]); }
+  }
+  parts->count = 0;
+  lval_del(parts);
+  lval_del(f);
+  return acc;
+}
+
+/* Reading a mapped file ahead of evaluating it: its top-level forms are */
+/* found a batch at a time with the structural index, and the batch is */
+/* split into chunks of about equal size that are read on the pool, */
+/* while the batch before is evaluated */
+
+/* How much source goes in a batch: little enough that what it reads */
+/* to, many times the size, is still in cache when it's evaluated */
+#define LBATCH_SIZE (64 << 10)
+
+/* A form found in the source, and what it reads to, or NULL if the */
+/* reader rejected it */
+typedef struct {
+  const char* src;
+  size_t len;
+  lval* read;
+} lform;
+
+typedef struct {
+  lform* forms;
+  int n;
+} lform_chunk;
+
+typedef struct {
+  lform* forms;
+  long count;
+  long cap;
+  lform_chunk* chunks;
+  ltask* tasks;
+  int* forked;
+  int ntasks;
+} lbatch;
+
+void lform_chunk_read(ltask* t) {
+  lform_chunk* c = t->arg;
+  for (int i = 0; i < c->n; i++) { c->forms[i].read = lval_read_src(c->forms[i].src, c->forms[i].len); }
+}
+
+/* Find the forms in about LBATCH_SIZE bytes of source from *pos, at */
+/* least one if there's any, and fork reading them. Leaves *pos after */
+/* the last */
+void lbatch_start(lbatch* b, lindex* x, size_t* pos) {
+  b->count = 0;
+  size_t stop = *pos + LBATCH_SIZE;
+  size_t i = lindex_next(x, *pos);
+  while (i < x->len && (i < stop || b->count == 0)) {
+    size_t end = lindex_form_end(x, i);
+    if (b->count == b->cap) {
+      b->cap = b->cap ? b->cap * 2 : 1024;
+      b->forms = realloc(b->forms, sizeof(lform) * b->cap);
+    }
+    b->forms[b->count++] = (lform){ x->src + i, end - i, NULL };
+    i = lindex_next(x, end);
+  }
+  size_t size = i - *pos;
+  *pos = i;
+
+  /* a few chunks per thread, so a slow one can be made up for */
+  int want = lpool.threads * 4;
+  if (!b->chunks) {
+    b->chunks = malloc(sizeof(lform_chunk) * want);
+    b->tasks = malloc(sizeof(ltask) * want);
+    b->forked = malloc(sizeof(int) * want);
+  }
+  b->ntasks = 0;
+  size_t chunk = size / want + 1;
+  for (long k = 0; k < b->count;) {
+    lform* first = &b->forms[k];
+    size_t bytes = 0;
+    do { bytes += b->forms[k++].len; } while (k < b->count && bytes < chunk);
+    int n = b->ntasks++;
+    b->chunks[n] = (lform_chunk){ first, (int)(&b->forms[k] - first) };
+    b->tasks[n] = (ltask){ NULL, NULL, NULL, 0, lform_chunk_read, &b->chunks[n] };
+    b->forked[n] = lpool_fork(&b->tasks[n]);
+    /* past the last chunk, the rest go in one */
+    if (b->ntasks == want - 1) { chunk = SIZE_MAX; }
+  }
+}
+
+/* Wait for a batch to be read, reading what wasn't forked here */
+void lbatch_finish(lbatch* b) {
+  for (int i = 0; i < b->ntasks; i++) {
+    if (!b->forked[i]) { lform_chunk_read(&b->tasks[i]); }
+  }
+  for (int i = b->ntasks - 1; i >= 0; i--) {
+    if (b->forked[i]) { lpool_join(&b->tasks[i]); }
+  }
+}
+
+void lbatch_free(lbatch* b) {
+  free(b->forms);
+  free(b->chunks);
+  free(b->tasks);
+  free(b->forked);
+}
+
+/* FUTURES */
+
+void* lfuture_thread(void* arg) {
+  lfuture* f = arg;
+  lval* result = lval_eval(f->env, f->expr);
+  lenv_del(f->env);
+
+  /* hand the result over, then wake anyone who got here first */
+  __atomic_store_n(&f->slot, result, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&f->lock);
+  pthread_cond_broadcast(&f->ready);
+  pthread_mutex_unlock(&f->lock);
+
+  lfuture_del(f);
+  return NULL;
+}
+
+/* (future {expr}) starts evaluating expr in the background */
+lval* builtin_future(lenv* e, lval* a) {
+  lfuture* f = malloc(sizeof(lfuture));
+  /* one for the handle, one for the thread */
+  f->refs = 2;
+  f->slot = NULL;
+  pthread_mutex_init(&f->lock, NULL);
+  pthread_cond_init(&f->ready, NULL);
+  /* the thread gets its own copy of the environment to read and def into */
+  f->env = lenv_snapshot(e);
+  f->expr = lval_take(a, 0);
+  f->expr->type = LVAL_SEXPR;
+
+  pthread_t t;
+  if (pthread_create(&t, NULL, lfuture_thread, f) != 0) {
+    lenv_del(f->env);
+    lval_del(f->expr);
+    f->refs = 1;
+    lfuture_del(f);
+    return lval_err("Could not start future!");
+  }
+  pthread_detach(t);
+  return lval_fut(f);
+}
+
+/* (await fut) blocks until the result is in */
+/* The only handle to a future gets the result itself, otherwise a copy */
+lval* builtin_await(lenv* e, lval* a) {
+  lfuture* f = a->cell[0]->fut;
+
+  lval* x = __atomic_load_n(&f->slot, __ATOMIC_ACQUIRE);
+  if (!x) {
+    pthread_mutex_lock(&f->lock);
+    while (!(x = __atomic_load_n(&f->slot, __ATOMIC_ACQUIRE))) {
+      pthread_cond_wait(&f->ready, &f->lock);
+    }
+    pthread_mutex_unlock(&f->lock);
+  }
+
+  /* the thread has let go by the time it fills the slot, or is about to */
+  /* - either way if refs is 1 after that, this handle is the last one */
+  if (__atomic_load_n(&f->refs, __ATOMIC_ACQUIRE) == 1) {
+    __atomic_store_n(&f->slot, NULL, __ATOMIC_RELAXED);
+  } else {
+    x = lval_copy(x);
+  }
+  lval_del(a);
+  return x;
+}
+
+/* (ready fut) is 1 once await wouldn't block */
+lval* builtin_ready(lenv* e, lval* a) {
+  int ready = __atomic_load_n(&a->cell[0]->fut->slot, __ATOMIC_ACQUIRE) != NULL;
+  lval_del(a);
+  return lval_num(ready);
+}
+
+/* Builtins that take sequences as they are, rather than forced */
+/* def binds them unforced, so a named generator can be endless */
+int lbuiltin_is_lazy(lbuiltin f) {
+  return f == builtin_map || f == builtin_filter || f == builtin_take
+      || f == builtin_reduce || f == builtin_def;
+}
+
+/* BUILTINS */
+
+lval* builtin_head(lenv* e, lval* a) {
+  /* Check for error conditions */
+  if (a->cell[0]->type == LVAL_VEC) { return lvec_slice(a, 0, 1); }
+  LASSERT_EMPTY_LIST(a);
+
+  /* If no error, take the first arg */
+  lval* v = lval_take(a, 0);
+  /* Delete all elements that are not the head */
+  while (v->count > 1) { lval_del(lval_pop(v, 1)); }
+  return v;
+}
+
+lval* builtin_tail(lenv* e, lval* a) {
+  /* Check for error conditions */
+  if (a->cell[0]->type == LVAL_VEC) { return lvec_slice(a, 1, a->cell[0]->count); }
+  LASSERT_EMPTY_LIST(a);
+
+  /* If no error, take the first arg */
+  lval* v = lval_take(a, 0);
+  /* Delete the first element and return */
+  lval_del(lval_pop(v, 0));
+  return v;
+}
+
+/* Collect the symbols body uses from local scopes into the closure */
+/* Globals are left to be looked up at call time, which is what lets */
+/* a def'd function call itself */
+void lclosure_capture(lclosure* c, lenv* e, lval* body) {
+  if (body->type == LVAL_SEXPR || body->type == LVAL_QEXPR) {
+    for (int i = 0; i < body->count; i++) {
+      lclosure_capture(c, e, body->cell[i]);
+    }
+    return;
+  }
+  if (body->type != LVAL_SYM) { return; }
+
+  for (int i = 0; i < c->argc; i++) {
+    if (c->formals[i] == body->sym) { return; }
+  }
+  if (lenv_lookup_local(&c->captured, body->sym)) { return; }
+
+  /* only scopes inside the global one are local */
+  lenv* root = lenv_root(e);
+  for (lenv* x = e; x != root; x = x->par) {
+    lval* v = lenv_lookup_local(x, body->sym);
+    if (v) {
+      int n = ++c->captured.count;
+      c->captured.syms = realloc(c->captured.syms, sizeof(char*) * n);
+      c->captured.vals = realloc(c->captured.vals, sizeof(lval*) * n);
+      c->captured.syms[n-1] = body->sym;
+      c->captured.vals[n-1] = lval_copy(v);
+      return;
+    }
+  }
+}
+
+/* Give the symbols in v, part of c's body, the index of their value in */
+/* c's call frames: a formal's position, or past the formals, where it */
+/* was captured. Globals are looked up by name, as are copies taken out */
+/* of the body, e.g. to build a lambda inside it */
+void lclosure_resolve(lclosure* c, lval* v) {
+  if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+    for (int i = 0; i < v->count; i++) { lclosure_resolve(c, v->cell[i]); }
+    return;
+  }
+  if (v->type != LVAL_SYM) { return; }
+
+  v->slot_in = NULL;
+  for (int i = 0; i < c->argc; i++) {
+    if (c->formals[i] == v->sym) { v->slot_in = c; v->slot = i; return; }
+  }
+  for (int i = 0; i < c->captured.count; i++) {
+    if (c->captured.syms[i] == v->sym) { v->slot_in = c; v->slot = c->argc + i; return; }
+  }
+}
+
+/* (\ {formals} {body}) */
+lval* builtin_lambda(lenv* e, lval* a) {
+  for (int i = 0; i < a->cell[0]->count; i++) {
+    LASSERT(a, a->cell[0]->cell[i]->type == LVAL_SYM, "Cannot define non-symbol");
+  }
+
+  lval* formals = lval_pop(a, 0);
+  lval* body = lval_take(a, 0);
+  body->type = LVAL_SEXPR;
+
+  lclosure* c = malloc(sizeof(lclosure));
+  c->refs = 1;
+  c->argc = formals->count;
+  c->formals = malloc(sizeof(char*) * (c->argc ? c->argc : 1));
+  for (int i = 0; i < c->argc; i++) { c->formals[i] = formals->cell[i]->sym; }
+  c->captured = (lenv){ NULL, 0, NULL, NULL };
+  c->body = body;
+  c->par_gen = -1;
+  c->par_root = NULL;
+  c->par_safe = 0;
+  lclosure_capture(c, e, body);
+  lclosure_resolve(c, body);
+
+  lval_del(formals);
+  return lval_lambda(c);
+}
+
+/* (def {syms...} vals...) binds globally */
+lval* builtin_def(lenv* e, lval* a) {
+  lval* syms = a->cell[0];
+  for (int i = 0; i < syms->count; i++) {
+    LASSERT(a, syms->cell[i]->type == LVAL_SYM, "Cannot define non-symbol");
+  }
+  LASSERT(a, syms->count == a->count - 1, "Cannot define incorrect number of values");
+
+  lenv* root = lenv_root(e);
+  for (int i = 0; i < syms->count; i++) {
+    lenv_put(root, syms->cell[i], a->cell[i+1]);
+  }
+
+  lval_del(a);
+  return lval_sexpr();
+}
+
+/* (if cond {then} {else}) */
+lval* builtin_if(lenv* e, lval* a) {
+  lval* x = lval_pop(a, a->cell[0]->num ? 1 : 2);
+  x->type = LVAL_SEXPR;
+  lval_del(a);
+  return lval_eval(e, x);
+}
+
+lval* builtin_ord(lenv* e, lval* a, char* op) {
+  long x = a->cell[0]->num;
+  long y = a->cell[1]->num;
+  int r = 0;
+  if (strcmp(op, "<") == 0) { r = x < y; }
+  if (strcmp(op, ">") == 0) { r = x > y; }
+  if (strcmp(op, "<=") == 0) { r = x <= y; }
+  if (strcmp(op, ">=") == 0) { r = x >= y; }
+
+  lval_del(a);
+  return lval_num(r);
+}
+
+lval* builtin_lt(lenv* e, lval* a) { return builtin_ord(e, a, "<"); }
+lval* builtin_gt(lenv* e, lval* a) { return builtin_ord(e, a, ">"); }
+lval* builtin_le(lenv* e, lval* a) { return builtin_ord(e, a, "<="); }
+lval* builtin_ge(lenv* e, lval* a) { return builtin_ord(e, a, ">="); }
+
+lval* builtin_cmp(lenv* e, lval* a, char* op) {
+  int r = lval_eq(a->cell[0], a->cell[1]);
+  if (strcmp(op, "!=") == 0) { r = !r; }
+  lval_del(a);
+  return lval_num(r);
+}
+
+lval* builtin_eq(lenv* e, lval* a) { return builtin_cmp(e, a, "=="); }
+lval* builtin_ne(lenv* e, lval* a) { return builtin_cmp(e, a, "!="); }
+
+/* Simply convert the given Sexpr to a Qexpr */
+/* Not unlike 'quote' */
+lval* builtin_list(lenv* e, lval* a) {
+  a->type = LVAL_QEXPR;
+  return a;
+}
+
+lval* builtin_eval(lenv* e, lval* a) {
   lval* x = lval_take(a, 0);
   x->type = LVAL_SEXPR;
   return lval_eval(e, x);
@@ -444,180 +3256,1136 @@ lval* lval_join(lenv* e, lval* x, lval* y) {
   return x;
 }
 
-lval* builtin_join(lenv* e, lval* a) {
-  for (int i = 0; i < a->count; i++) {
-    LASSERT_TYPE(a, LVAL_QEXPR);
+lval* builtin_join(lenv* e, lval* a) {
+  lval* x = lval_pop(a, 0);
+
+  while (a->count) {
+    x = lval_join(e, x, lval_pop(a, 0));
+  }
+
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_len(lenv* e, lval* a) {
+  lval* v = lval_take(a, 0);
+  int cnt = v->count;
+  lval_del(v);
+  return lval_num(cnt);
+}
+
+lval* builtin_init(lenv* e, lval* a) {
+  LASSERT_EMPTY_LIST(a);
+
+  /* if no error, take the first arg */
+  lval* v = lval_take(a, 0);
+
+  // delete the last element of v
+  lval_del(lval_pop(v, v->count-1));
+  return v;
+}
+
+lval* builtin_cons(lenv* e, lval* a) {
+  /* get first val and second qexpr */
+  lval *v = lval_pop(a, 0);
+  lval* q = lval_pop(a, 0);
+  /* create a new qexpr */
+  lval *ret = lval_qexpr();
+
+  /* add the value and then join it with the list */
+  lval_add(ret, v);
+  lval_join(e, ret, q);
+
+  lval_del(a);
+  return ret;
+}
+
+lval* builtin_op(lenv* e, lval* a, char* op) {
+  /* args are numbers or vectors of them */
+  int vecs = 0;
+  for (int i = 0; i < a->count; i++) { vecs += a->cell[i]->type == LVAL_VEC; }
+  if (vecs) { return lvec_op(a, op); }
+
+  int add = strcmp(op, "+") == 0 || strcmp(op, "add") == 0;
+  int sub = strcmp(op, "-") == 0 || strcmp(op, "sub") == 0;
+  int mul = strcmp(op, "*") == 0 || strcmp(op, "mul") == 0;
+  int div = strcmp(op, "/") == 0 || strcmp(op, "div") == 0;
+  int max = strcmp(op, "max") == 0;
+  int min = strcmp(op, "min") == 0;
+
+  /* wide reductions go through the vector kernels */
+  if (a->count >= LREDUCE_MIN && (add || max || min)) {
+    return lreduce_op(a, add ? lsum : max ? lmax : lmin);
+  }
+
+  long x = a->cell[0]->num;
+
+  /* If no arguments and subtraction, perform unary negation */
+  if (sub && a->count == 1) {
+    x = (long)(0UL - (unsigned long)x);
+  }
+
+  /* net number of times the sum wrapped, see lsum_scalar */
+  int carry = 0;
+
+  for (int i = 1; i < a->count; i++) {
+    long y = a->cell[i]->num;
+
+    if (add && __builtin_add_overflow(x, y, &x)) { carry += y > 0 ? 1 : -1; }
+    /* - and * wrap, as the vector kernels do */
+    if (sub) { x = (long)((unsigned long)x - (unsigned long)y); }
+    if (mul) { x = (long)((unsigned long)x * (unsigned long)y); }
+    if ((div || strcmp(op, "%") == 0) && y == 0) {
+      lval_del(a);
+      return lval_err("Division By Zero!");
+    }
+    /* the one quotient that doesn't fit, which traps rather than wraps */
+    if (div && x == LONG_MIN && y == -1) {
+      lval_del(a);
+      return lval_err("Integer overflow!");
+    }
+    if (div) { x /= y; }
+    if (strcmp(op, "^") == 0) { pow((double)x, (double)y); }
+    if (strcmp(op, "%") == 0) { x = y == -1 ? 0 : x % y; }
+    if (max) { if (x <= y) { x = y; }}
+    if (min) { if (x <= y) {} else { x = y; }}
+  }
+
+  lval_del(a);
+  return carry ? lval_err("Integer overflow!") : lval_num(x);
+}
+
+lval* builtin_add(lenv* e, lval* a) {
+  return builtin_op(e, a, "+");
+}
+
+lval* builtin_sub(lenv* e, lval* a) {
+  return builtin_op(e, a, "-");
+}
+
+lval* builtin_mul(lenv* e, lval* a) {
+  return builtin_op(e, a, "*");
+}
+
+lval* builtin_div(lenv* e, lval* a) {
+  return builtin_op(e, a, "/");
+}
+
+lval* builtin_max(lenv* e, lval* a) {
+  return builtin_op(e, a, "max");
+}
+
+lval* builtin_min(lenv* e, lval* a) {
+  return builtin_op(e, a, "min");
+}
+
+lval* builtin_pow(lenv* e, lval* a) {
+  return builtin_op(e, a, "^");
+}
+
+lval* builtin_mod(lenv* e, lval* a) {
+  return builtin_op(e, a, "%");
+}
+
+/* OPTIMIZE */
+
+/* Number of call nodes replaced by the folding pass, reported with -d */
+__thread int lval_folded = 0;
+
+/* Set once the pass walks past a call that might rebind something */
+/* (def, eval, a lambda...) - everything evaluated after it is left alone */
+__thread int lval_fold_barrier = 0;
+
+/* Builtins whose result depends only on their arguments */
+int lbuiltin_is_pure(lbuiltin f) {
+  return f == builtin_add || f == builtin_sub || f == builtin_mul
+      || f == builtin_div || f == builtin_mod || f == builtin_max
+      || f == builtin_min || f == builtin_len || f == builtin_head
+      || f == builtin_join || f == builtin_lt || f == builtin_gt
+      || f == builtin_le || f == builtin_ge || f == builtin_eq
+      || f == builtin_ne;
+}
+
+/* Pure builtins where argument order doesn't matter */
+int lbuiltin_is_commutative(lbuiltin f) {
+  return f == builtin_add || f == builtin_mul
+      || f == builtin_max || f == builtin_min;
+}
+
+/* Qexprs are never evaluated, so they are as constant as numbers */
+int lval_is_literal(lval* v) {
+  return v->type == LVAL_NUM || v->type == LVAL_QEXPR;
+}
+
+/* Fold the numeric literal args of a commutative call into one */
+/* e.g. (* x 2 3) becomes (* x 6), and (* x 1) becomes (* x). + only */
+/* reports overflow if the exact sum of all its args doesn't fit, on */
+/* numbers and on each lane of a vector, so grouping the literals can't */
+/* change the answer: (+ x 5 -5) becomes (+ x) */
+lval* lval_fold_partial(lenv* e, lval* v, lbuiltin f) {
+  lval* head = lval_pop(v, 0);
+  lval* nums = lval_sexpr();
+  lval* rest = lval_sexpr();
+  while (v->count) {
+    lval* x = lval_pop(v, 0);
+    x->type == LVAL_NUM ? lval_add(nums, x) : lval_add(rest, x);
+  }
+  lval_del(v);
+
+  lval* call = lval_add(lval_sexpr(), head);
+  if (nums->count == 0) { lval_del(nums); return lval_join(e, call, rest); }
+
+  int merged = nums->count;
+  lval* r = f(e, lval_copy(nums));
+
+  /* e.g. the literals overflow - leave them for eval to report */
+  if (r->type == LVAL_ERR) {
+    lval_del(r);
+    return lval_join(e, lval_join(e, call, nums), rest);
+  }
+  lval_del(nums);
+
+  /* drop the identity element as long as something is left to check */
+  int identity = (f == builtin_add && r->num == 0)
+              || (f == builtin_mul && r->num == 1);
+  if (identity && rest->count > 0) {
+    lval_del(r);
+    call = lval_join(e, call, rest);
+  } else {
+    merged--;
+    call = lval_add(lval_join(e, call, rest), r);
+  }
+
+  if (merged > 0) { lval_folded++; }
+  return call;
+}
+
+/* Replace constant calls to pure builtins with their result */
+/* The head symbol is resolved in the current environment, so rebinding */
+/* e.g. + to something else disables folding of (+ ...) */
+lval* lval_fold(lenv* e, lval* v) {
+  if (v->type != LVAL_SEXPR) { return v; }
+
+  /* fold the children first so constants bubble up */
+  int literal = 1;
+  int nums = 0;
+  for (int i = 0; i < v->count; i++) {
+    v->cell[i] = lval_fold(e, v->cell[i]);
+    if (i == 0) { continue; }
+    if (!lval_is_literal(v->cell[i])) { literal = 0; }
+    if (v->cell[i]->type == LVAL_NUM) { nums++; }
+  }
+
+  if (v->count == 0 || lval_fold_barrier) { return v; }
+
+  /* anything but a known pure builtin may change what later code means */
+  lval* f = v->cell[0]->type == LVAL_SYM ? lenv_lookup(e, v->cell[0]) : NULL;
+  if (!f || f->type != LVAL_FUN || !f->fun || !lbuiltin_is_pure(f->fun)) {
+    lval_fold_barrier = 1;
+    return v;
+  }
+  if (v->count < 2) { return v; }
+
+  if (!literal) {
+    if (nums >= 2 && lbuiltin_is_commutative(f->fun)) {
+      return lval_fold_partial(e, v, f->fun);
+    }
+    return v;
+  }
+
+  /* run the builtin on a copy, keeping the original if it fails */
+  /* so that the error is still reported at eval time */
+  lval* a = lval_copy(v);
+  lval_del(lval_pop(a, 0));
+  lval* r = lbuiltin_call(e, f, a);
+  if (r->type == LVAL_ERR) { lval_del(r); return v; }
+
+  lval_folded++;
+  lval_del(v);
+  return r;
+}
+
+/* Type inference: marks the builtin call sites whose args are known to */
+/* fit the builtin's signature, so lval_eval_sexpr can skip the check. */
+/* A type here is a mask of the lval types a value might have - never */
+/* LVAL_ERR, as an error stops evaluation before anything sees it */
+
+#define LTYPE_ANY (~(1 << LVAL_ERR))
+
+/* Number of call sites marked, reported with -d */
+__thread int lval_typed = 0;
+
+/* What the formals of the lambda whose body is being inferred are */
+/* known to be at this point in it. Formals are never rebound, so once */
+/* a check on one has passed it stays passed */
+typedef struct linfer {
+  int count;
+  lval** formals;
+  int* types;
+  struct linfer* up;
+} linfer;
+
+/* Index of sym among the innermost lambda's formals, or -1 */
+int linfer_formal(linfer* s, char* sym) {
+  for (int i = 0; i < s->count; i++) {
+    if (s->formals[i]->sym == sym) { return i; }
+  }
+  return -1;
+}
+
+/* Whether sym might not mean what it does globally */
+int linfer_shadowed(linfer* s, char* sym) {
+  for (; s; s = s->up) {
+    if (linfer_formal(s, sym) >= 0) { return 1; }
+  }
+  return 0;
+}
+
+int linfer_sym(linfer* s, lval* v) {
+  int i = linfer_formal(s, v->sym);
+  return i >= 0 ? s->types[i] : LTYPE_ANY;
+}
+
+/* What an arg of type t is by the time a builtin sees it - sequences */
+/* are forced into Qexprs for all but the lazy builtins */
+int linfer_arg(lsig* sig, int t) {
+  if (lbuiltin_is_lazy(sig->fun) || !(t & 1 << LVAL_SEQ)) { return t; }
+  return (t & ~(1 << LVAL_SEQ)) | 1 << LVAL_QEXPR;
+}
+
+/* Infer the code v, a call site or a single value. Returns its type, */
+/* and leaves s narrowed by whatever checks must pass to get past it */
+int linfer_call(lenv* e, lval* v, linfer* s) {
+  if (v->count == 0) { return 1 << LVAL_SEXPR; }
+
+  /* args may be evaluated in parallel, so each starts from what was */
+  /* known before any of them - but all of them have passed by the call */
+  int n = s->count;
+  int before[n + 1], after[n + 1], types[v->count];
+  memcpy(before, s->types, sizeof(int) * n);
+  memcpy(after, s->types, sizeof(int) * n);
+  for (int i = 0; i < v->count; i++) {
+    memcpy(s->types, before, sizeof(int) * n);
+    types[i] = v->cell[i]->type == LVAL_SEXPR ? linfer_call(e, v->cell[i], s)
+             : v->cell[i]->type == LVAL_SYM ? LTYPE_ANY
+             : 1 << v->cell[i]->type;
+    for (int k = 0; k < n; k++) { after[k] &= s->types[k]; }
+  }
+  memcpy(s->types, after, sizeof(int) * n);
+  for (int i = 0; i < v->count; i++) {
+    if (v->cell[i]->type == LVAL_SYM) { types[i] = linfer_sym(s, v->cell[i]); }
+  }
+
+  /* a lone function is called, anything else is just the value */
+  if (v->count == 1) { return types[0] & 1 << LVAL_FUN ? LTYPE_ANY : types[0]; }
+
+  lval* h = v->cell[0];
+  if (h->type != LVAL_SYM || linfer_shadowed(s, h->sym)) { return LTYPE_ANY; }
+  lval* f = lenv_lookup(e, h);
+  if (!f || f->type != LVAL_FUN || !f->sig) { return LTYPE_ANY; }
+  lsig* sig = f->sig;
+
+  int argc = v->count - 1;
+  int fits = argc >= sig->min && (sig->max < 0 || argc <= sig->max);
+  int nums = 1;
+  char* t = sig->types;
+  for (int i = 1; i < v->count; i++) {
+    int a = linfer_arg(sig, types[i]);
+    if (a & ~lsig_mask[(int)*t]) { fits = 0; }
+    if (a & ~(1 << LVAL_NUM)) { nums = 0; }
+    if (t[1]) { t++; }
+  }
+
+  if (fits) {
+    v->typed = sig;
+    v->typed_gen = __atomic_load_n(&lbuiltin_generation, __ATOMIC_ACQUIRE);
+    lval_typed++;
+  } else {
+    /* the check will run, and anything after it can count on it */
+    t = sig->types;
+    for (int i = 1; i < v->count; i++) {
+      int k = v->cell[i]->type == LVAL_SYM ? linfer_formal(s, v->cell[i]->sym) : -1;
+      if (k >= 0) {
+        int ok = lsig_mask[(int)*t];
+        if (!lbuiltin_is_lazy(sig->fun) && ok & 1 << LVAL_QEXPR) { ok |= 1 << LVAL_SEQ; }
+        s->types[k] &= ok;
+      }
+      if (t[1]) { t++; }
+    }
+  }
+
+  /* a lambda body runs later, on formals it knows nothing about yet */
+  if (sig->fun == builtin_lambda && argc == 2
+      && v->cell[1]->type == LVAL_QEXPR && v->cell[2]->type == LVAL_QEXPR) {
+    lval* formals = v->cell[1];
+    int k = formals->count;
+    int ftypes[k + 1];
+    for (int i = 0; i < k; i++) {
+      if (formals->cell[i]->type != LVAL_SYM) { return lsig_mask[(int)sig->ret]; }
+      ftypes[i] = LTYPE_ANY;
+    }
+    linfer inner = { k, formals->cell, ftypes, s };
+    linfer_call(e, v->cell[2], &inner);
+  }
+
+  /* if runs a branch once the condition has passed */
+  if (sig->fun == builtin_if && argc == 3
+      && v->cell[2]->type == LVAL_QEXPR && v->cell[3]->type == LVAL_QEXPR) {
+    int cond[n + 1];
+    memcpy(cond, s->types, sizeof(int) * n);
+    int r = linfer_call(e, v->cell[2], s);
+    memcpy(s->types, cond, sizeof(int) * n);
+    r |= linfer_call(e, v->cell[3], s);
+    memcpy(s->types, cond, sizeof(int) * n);
+    return r;
+  }
+
+  /* arithmetic on plain numbers gives a plain number */
+  if (sig->ret == 'N' && nums) { return 1 << LVAL_NUM; }
+  return lsig_mask[(int)sig->ret] & LTYPE_ANY;
+}
+
+/* Infer a top-level expression, marking its call sites */
+lval* lval_infer(lenv* e, lval* v) {
+  if (v->type == LVAL_SEXPR) {
+    linfer top = { 0, NULL, NULL, NULL };
+    linfer_call(e, v, &top);
+  }
+  return v;
+}
+
+/* Every builtin, with the fewest and most args it takes (-1 for no */
+/* limit), the type of each arg, checked by lsig_check before it's */
+/* called, and the type it returns. The last arg type covers any args */
+/* past the end: */
+/*   n number        q Qexpr           s Qexpr, vector or sequence */
+/*   N number/vector l Qexpr or vector f function */
+/*   v vector        u future          a anything */
+#define LBUILTINS(X) \
+  X("list",    builtin_list,    0, -1, "a",    'q') \
+  X("head",    builtin_head,    1,  1, "l",    'l') \
+  X("tail",    builtin_tail,    1,  1, "l",    'l') \
+  X("join",    builtin_join,    1, -1, "q",    'q') \
+  X("len",     builtin_len,     1,  1, "l",    'n') \
+  X("eval",    builtin_eval,    1,  1, "q",    'a') \
+  X("init",    builtin_init,    1,  1, "q",    'q') \
+  X("cons",    builtin_cons,    2,  2, "aq",   'q') \
+  X("+",       builtin_add,     1, -1, "N",    'N') \
+  X("add",     builtin_add,     1, -1, "N",    'N') \
+  X("-",       builtin_sub,     1, -1, "N",    'N') \
+  X("sub",     builtin_sub,     1, -1, "N",    'N') \
+  X("*",       builtin_mul,     1, -1, "N",    'N') \
+  X("mul",     builtin_mul,     1, -1, "N",    'N') \
+  X("/",       builtin_div,     1, -1, "N",    'N') \
+  X("div",     builtin_div,     1, -1, "N",    'N') \
+  X("^",       builtin_pow,     1, -1, "N",    'N') \
+  X("pow",     builtin_pow,     1, -1, "N",    'N') \
+  X("%",       builtin_mod,     1, -1, "N",    'N') \
+  X("mod",     builtin_mod,     1, -1, "N",    'N') \
+  X("max",     builtin_max,     1, -1, "N",    'N') \
+  X("min",     builtin_min,     1, -1, "N",    'N') \
+  X("range",   builtin_range,   1,  3, "n",    's') \
+  X("gen",     builtin_gen,     1,  1, "f",    's') \
+  X("yield",   builtin_yield,   1,  1, "a",    'a') \
+  X("map",     builtin_map,     2,  2, "fs",   's') \
+  X("filter",  builtin_filter,  2,  2, "fs",   's') \
+  X("take",    builtin_take,    2,  2, "ns",   's') \
+  X("reduce",  builtin_reduce,  3,  3, "fas",  'a') \
+  X("pmap",    builtin_pmap,    2,  3, "fln",  'q') \
+  X("preduce", builtin_preduce, 3,  4, "faln", 'a') \
+  X("future",  builtin_future,  1,  1, "q",    'u') \
+  X("await",   builtin_await,   1,  1, "u",    'a') \
+  X("ready",   builtin_ready,   1,  1, "u",    'n') \
+  X("vec",     builtin_vec,     1,  1, "q",    'v') \
+  X("unvec",   builtin_unvec,   1,  1, "v",    'q') \
+  X("\\",      builtin_lambda,  2,  2, "q",    'f') \
+  X("def",     builtin_def,     1, -1, "qa",   'a') \
+  X("if",      builtin_if,      3,  3, "nq",   'a') \
+  X("<",       builtin_lt,      2,  2, "n",    'n') \
+  X(">",       builtin_gt,      2,  2, "n",    'n') \
+  X("<=",      builtin_le,      2,  2, "n",    'n') \
+  X(">=",      builtin_ge,      2,  2, "n",    'n') \
+  X("==",      builtin_eq,      2,  2, "a",    'n') \
+  X("!=",      builtin_ne,      2,  2, "a",    'n')
+
+#define LSIG_ENTRY(name, fun, min, max, types, ret) { name, fun, min, max, types, ret },
+lsig lbuiltin_sigs[] = { LBUILTINS(LSIG_ENTRY) };
+#undef LSIG_ENTRY
+
+/* Register builtins with environment */
+/* The table's names are all distinct and e is new, so the bindings go */
+/* straight in rather than through lenv_put and its copies */
+void lenv_add_builtins(lenv* e) {
+  int n = sizeof(lbuiltin_sigs) / sizeof(lsig);
+  e->syms = realloc(e->syms, sizeof(char*) * (e->count + n));
+  e->vals = realloc(e->vals, sizeof(lval*) * (e->count + n));
+  for (int i = 0; i < n; i++) {
+    e->syms[e->count] = lsym_intern(lbuiltin_sigs[i].name);
+    e->vals[e->count] = lval_fun(&lbuiltin_sigs[i]);
+    e->count++;
+  }
+  __atomic_add_fetch(&lenv_generation, 1, __ATOMIC_RELEASE);
+}
+
+
+/* IMAGES */
+
+/* An environment saved as one block, to be mapped straight back in */
+/* rather than rebuilt. Pointers in the block are stored as offsets from */
+/* its start, and every place one is stored is listed, as are the places */
+/* naming a symbol or builtin, so loading is a single pass of fixups. */
+/* The mapping is private, so what the interpreter writes into loaded */
+/* values (closure refcounts, inferred types) never reaches the file */
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIMAGE_MAGIC "blispimg"
+#define LIMAGE_VERSION 4
+
+typedef struct {
+  char magic[8];
+  int version;
+  /* a check that the image comes from a build with the same layout */
+  int lval_size;
+  size_t size;
+  /* offset of the saved lenv */
+  size_t env;
+  /* arrays of offsets: pointers to relocate, symbol names to intern, */
+  /* and builtins, whose sig holds the offset of their name */
+  size_t rel, rel_count;
+  size_t sym, sym_count;
+  size_t sig, sig_count;
+} limage_header;
+
+/* A growable array of offsets */
+typedef struct {
+  size_t count;
+  size_t cap;
+  size_t* offs;
+} limage_offs;
+
+/* A map from pointers to offsets, for closures and symbol names */
+/* already written, so shared ones are written once */
+typedef struct {
+  size_t count;
+  size_t size;
+  void** keys;
+  size_t* offs;
+} lptrmap;
+
+typedef struct {
+  char* buf;
+  size_t len;
+  size_t cap;
+  limage_offs rel, sym, sig;
+  lptrmap seen;
+} limage_writer;
+
+void limage_offs_add(limage_offs* o, size_t off) {
+  if (o->count == o->cap) {
+    o->cap = o->cap ? o->cap * 2 : 256;
+    o->offs = realloc(o->offs, sizeof(size_t) * o->cap);
+  }
+  o->offs[o->count++] = off;
+}
+
+size_t* lptrmap_slot(lptrmap* m, void* key) {
+  if (2 * (m->count + 1) > m->size) {
+    size_t size = m->size ? m->size * 2 : 256;
+    void** keys = calloc(size, sizeof(void*));
+    size_t* offs = malloc(sizeof(size_t) * size);
+    for (size_t i = 0; i < m->size; i++) {
+      if (!m->keys[i]) { continue; }
+      size_t j = ((uintptr_t)m->keys[i] >> 4) & (size - 1);
+      while (keys[j]) { j = (j + 1) & (size - 1); }
+      keys[j] = m->keys[i];
+      offs[j] = m->offs[i];
+    }
+    free(m->keys);
+    free(m->offs);
+    m->keys = keys;
+    m->offs = offs;
+    m->size = size;
+  }
+  size_t j = ((uintptr_t)key >> 4) & (m->size - 1);
+  while (m->keys[j] && m->keys[j] != key) { j = (j + 1) & (m->size - 1); }
+  if (!m->keys[j]) {
+    m->keys[j] = key;
+    m->offs[j] = 0;
+    m->count++;
+  }
+  return &m->offs[j];
+}
+
+/* Room for n zeroed bytes, 8-aligned, returning its offset */
+size_t limage_alloc(limage_writer* w, size_t n) {
+  n = (n + 7) & ~(size_t)7;
+  if (w->len + n > w->cap) {
+    while (w->len + n > w->cap) { w->cap *= 2; }
+    w->buf = realloc(w->buf, w->cap);
   }
+  size_t off = w->len;
+  memset(w->buf + off, 0, n);
+  w->len += n;
+  return off;
+}
 
-  lval* x = lval_pop(a, 0);
+/* Store a pointer to the object at target in the slot at off */
+void limage_ptr(limage_writer* w, size_t off, size_t target) {
+  *(size_t*)(w->buf + off) = target;
+  if (target) { limage_offs_add(&w->rel, off); }
+}
 
-  while (a->count) {
-    x = lval_join(e, x, lval_pop(a, 0));
+/* Store a symbol name in the slot at off, interned again on loading */
+void limage_sym(limage_writer* w, size_t off, char* sym) {
+  size_t* seen = lptrmap_slot(&w->seen, sym);
+  if (!*seen) {
+    size_t len = strlen(sym) + 1;
+    *seen = limage_alloc(w, len);
+    memcpy(w->buf + *seen, sym, len);
   }
+  *(size_t*)(w->buf + off) = *seen;
+  limage_offs_add(&w->sym, off);
+}
 
-  lval_del(a);
-  return x;
+/* Sequences and futures are tied to this process, so can't be saved */
+int limage_saveable(lval* v) {
+  switch (v->type) {
+    case LVAL_SEQ: case LVAL_FUT: return 0;
+    case LVAL_SEXPR: case LVAL_QEXPR:
+      for (int i = 0; i < v->count; i++) {
+        if (!limage_saveable(v->cell[i])) { return 0; }
+      }
+      return 1;
+    case LVAL_FUN:
+      if (!v->closure) { return 1; }
+      for (int i = 0; i < v->closure->captured.count; i++) {
+        if (!limage_saveable(v->closure->captured.vals[i])) { return 0; }
+      }
+      return limage_saveable(v->closure->body);
+  }
+  return 1;
 }
 
-lval* builtin_len(lenv* e, lval* a) {
-  /* This is not quite it */
-  /* You need to ensure it's called on a Qexpr */
-  LASSERT_ARG_NUM(a, 1);
-  LASSERT_TYPE(a, LVAL_QEXPR);
+size_t limage_lval(limage_writer* w, lval* v);
 
-  lval* v = lval_take(a, 0);
-  int cnt = v->count;
-  lval_del(v);
-  return lval_num(cnt);
+/* Write e's bindings into the lenv at off */
+void limage_env(limage_writer* w, size_t off, lenv* e) {
+  size_t syms = limage_alloc(w, sizeof(char*) * e->count);
+  size_t vals = limage_alloc(w, sizeof(lval*) * e->count);
+  ((lenv*)(w->buf + off))->count = e->count;
+  limage_ptr(w, off + offsetof(lenv, syms), syms);
+  limage_ptr(w, off + offsetof(lenv, vals), vals);
+  for (int i = 0; i < e->count; i++) {
+    limage_sym(w, syms + sizeof(char*) * i, e->syms[i]);
+    limage_ptr(w, vals + sizeof(lval*) * i, limage_lval(w, e->vals[i]));
+  }
 }
 
-lval* builtin_init(lenv* e, lval* a) {
-  LASSERT_ARG_NUM(a, 1);
-  LASSERT_TYPE(a, LVAL_QEXPR);
-  LASSERT_EMPTY_LIST(a);
-
-  /* if no error, take the first arg */
-  lval* v = lval_take(a, 0);
+size_t limage_closure(limage_writer* w, lclosure* c) {
+  size_t* seen = lptrmap_slot(&w->seen, c);
+  if (*seen) { return *seen; }
+  size_t off = *seen = limage_alloc(w, sizeof(lclosure));
+  lclosure* x = (lclosure*)(w->buf + off);
+  x->refs = 1;
+  x->argc = c->argc;
+  x->par_gen = -1;
+  x->par_root = NULL;
 
-  // delete the last element of v
-  lval_del(lval_pop(v, v->count-1));
-  return v;
+  size_t formals = limage_alloc(w, sizeof(char*) * c->argc);
+  limage_ptr(w, off + offsetof(lclosure, formals), formals);
+  for (int i = 0; i < c->argc; i++) {
+    limage_sym(w, formals + sizeof(char*) * i, c->formals[i]);
+  }
+  limage_env(w, off + offsetof(lclosure, captured), &c->captured);
+  limage_ptr(w, off + offsetof(lclosure, body), limage_lval(w, c->body));
+  return off;
 }
 
-lval* builtin_cons(lenv* e, lval* a) {
-  LASSERT_ARG_NUM(a, 2);
-  /* TODO: assert types? */
-  
-  /* get first val and second qexpr */
-  lval *v = lval_pop(a, 0);
-  lval* q = lval_pop(a, 0);
-  /* create a new qexpr */
-  lval *ret = lval_qexpr();
+/* Write v, returning its offset. buf may move with every write, so */
+/* offsets are held rather than pointers */
+size_t limage_lval(limage_writer* w, lval* v) {
+  size_t off = limage_alloc(w, sizeof(lval));
+  ((lval*)(w->buf + off))->type = v->type;
 
-  /* add the value and then join it with the list */
-  lval_add(ret, v);
-  lval_join(e, ret, q);
+  switch (v->type) {
+    case LVAL_FUN:
+      if (v->closure) {
+        limage_ptr(w, off + offsetof(lval, closure), limage_closure(w, v->closure));
+      } else {
+        /* a builtin, looked up again by name */
+        size_t len = strlen(v->sig->name) + 1;
+        size_t name = limage_alloc(w, len);
+        memcpy(w->buf + name, v->sig->name, len);
+        *(size_t*)(w->buf + off + offsetof(lval, sig)) = name;
+        limage_offs_add(&w->sig, off);
+      }
+      break;
+    case LVAL_NUM: ((lval*)(w->buf + off))->num = v->num; break;
+    case LVAL_ERR: {
+      size_t len = strlen(v->err) + 1;
+      size_t err = limage_alloc(w, len);
+      memcpy(w->buf + err, v->err, len);
+      limage_ptr(w, off + offsetof(lval, err), err);
+      break;
+    }
+    case LVAL_SYM:
+      limage_sym(w, off + offsetof(lval, sym), v->sym);
+      /* only in a body, so its closure is already being written */
+      if (v->slot_in) {
+        ((lval*)(w->buf + off))->slot = v->slot;
+        limage_ptr(w, off + offsetof(lval, slot_in), *lptrmap_slot(&w->seen, v->slot_in));
+      }
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR: {
+      /* inferred types are for this process's builtins, so left out */
+      size_t cell = limage_alloc(w, sizeof(lval*) * v->count);
+      ((lval*)(w->buf + off))->count = v->count;
+      limage_ptr(w, off + offsetof(lval, cell), v->count ? cell : 0);
+      for (int i = 0; i < v->count; i++) {
+        limage_ptr(w, cell + sizeof(lval*) * i, limage_lval(w, v->cell[i]));
+      }
+      break;
+    }
+    case LVAL_VEC: {
+      size_t vec = limage_alloc(w, sizeof(long) * (v->count ? v->count : 1));
+      memcpy(w->buf + vec, v->vec, sizeof(long) * v->count);
+      ((lval*)(w->buf + off))->count = v->count;
+      limage_ptr(w, off + offsetof(lval, vec), vec);
+      break;
+    }
+  }
+  return off;
+}
 
-  lval_del(a);
-  return ret;
+size_t limage_table(limage_writer* w, limage_offs* o) {
+  size_t off = limage_alloc(w, sizeof(size_t) * o->count);
+  memcpy(w->buf + off, o->offs, sizeof(size_t) * o->count);
+  return off;
 }
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
-  /* Ensure all args are numbers */
-  for (int i = 0; i < a->count; i++) {
-    if (a->cell[i]->type != LVAL_NUM) {
-      lval_del(a);
-      return lval_err("Cannot operate on non-number!");
+/* Save e's bindings to path, all but builtins still under their own */
+/* names, which every environment starts with anyway */
+/* Returns 0, or -1 with errno set */
+int limage_save(lenv* e, const char* path) {
+  limage_writer w = { .buf = malloc(65536), .cap = 65536 };
+  size_t header = limage_alloc(&w, sizeof(limage_header));
+
+  /* the bindings worth saving, as an lenv of their own */
+  lenv keep = { NULL, 0, malloc(sizeof(char*) * (e->count + 1)), malloc(sizeof(lval*) * (e->count + 1)) };
+  for (int i = 0; i < e->count; i++) {
+    lval* v = e->vals[i];
+    if (v->type == LVAL_FUN && v->sig && lsym_intern(v->sig->name) == e->syms[i]) { continue; }
+    if (!limage_saveable(v)) {
+      fprintf(stderr, "not saving %s: sequences and futures can't be saved\n", e->syms[i]);
+      continue;
     }
+    keep.syms[keep.count] = e->syms[i];
+    keep.vals[keep.count++] = v;
   }
+  size_t env = limage_alloc(&w, sizeof(lenv));
+  limage_env(&w, env, &keep);
+  free(keep.syms);
+  free(keep.vals);
 
-  lval* x = lval_pop(a, 0);
+  limage_header h = { LIMAGE_MAGIC, LIMAGE_VERSION, sizeof(lval) };
+  h.env = env;
+  h.sym = limage_table(&w, &w.sym);
+  h.sym_count = w.sym.count;
+  h.sig = limage_table(&w, &w.sig);
+  h.sig_count = w.sig.count;
+  h.rel = limage_table(&w, &w.rel);
+  h.rel_count = w.rel.count;
+  h.size = w.len;
+  memcpy(w.buf + header, &h, sizeof(h));
 
-  /* If no arguments and subtraction, perform unary negation */
-  if ((strcmp(op, "-") == 0 || strcmp(op, "sub") == 0) && a->count == 0) {
-    x->num = -x->num;
+  int ok = 0;
+  FILE* f = fopen(path, "wb");
+  if (f) {
+    ok = fwrite(w.buf, 1, w.len, f) == w.len;
+    ok = (fclose(f) == 0) && ok;
   }
+  free(w.buf);
+  free(w.rel.offs);
+  free(w.sym.offs);
+  free(w.sig.offs);
+  free(w.seen.keys);
+  free(w.seen.offs);
+  return ok ? 0 : -1;
+}
 
-  //consume the children
-  while (a->count > 0) {
-    lval* y = lval_pop(a, 0);
+/* Map the image at path and bind everything in it in e */
+/* Returns 0, or -1 with errno set */
+int limage_load(lenv* e, const char* path) {
+  /* one image per process, so ownership is a single range check */
+  if (limage_base) { errno = EBUSY; return -1; }
 
-    if (strcmp(op, "+") == 0 || strcmp(op, "add") == 0) { x->num += y->num; }
-    if (strcmp(op, "-") == 0 || strcmp(op, "sub") == 0) { x->num -= y->num; }
-    if (strcmp(op, "*") == 0 || strcmp(op, "mul") == 0) { x->num *= y->num; }
-    if (strcmp(op, "/") == 0 || strcmp(op, "div") == 0) {
-      if (y->num == 0) {
-        lval_del(x); lval_del(y);
-        x = lval_err("Division By Zero!"); break;
-      }
-      x->num /= y->num;
-    }
-    if (strcmp(op, "^") == 0) { pow((double)x->num, (double)y->num); }
-    if (strcmp(op, "%") == 0) { x-> num = x->num % y->num; }
-    if (strcmp(op, "max") == 0) { if (x->num <= y->num) { x->num = y->num; }}
-    if (strcmp(op, "min") == 0) { if (x->num <= y->num) {} else { x->num = y->num; }}
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) { return -1; }
+  struct stat st;
+  if (fstat(fd, &st) < 0) { close(fd); return -1; }
+  if ((size_t)st.st_size < sizeof(limage_header)) { close(fd); errno = EINVAL; return -1; }
+  char* base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) { return -1; }
 
-    lval_del(y);
+  limage_header* h = (limage_header*)base;
+  size_t size = st.st_size;
+  int ok = memcmp(h->magic, LIMAGE_MAGIC, 8) == 0 && h->version == LIMAGE_VERSION
+    && h->lval_size == sizeof(lval) && h->size == size && h->env <= size - sizeof(lenv)
+    && h->rel <= size && h->rel_count <= (size - h->rel) / sizeof(size_t)
+    && h->sym <= size && h->sym_count <= (size - h->sym) / sizeof(size_t)
+    && h->sig <= size && h->sig_count <= (size - h->sig) / sizeof(size_t);
+  size_t* rel = (size_t*)(base + h->rel);
+  size_t* sym = (size_t*)(base + h->sym);
+  size_t* sig = (size_t*)(base + h->sig);
+
+  /* the fixups, checking every offset stays in the image */
+  for (size_t i = 0; ok && i < h->rel_count; i++) {
+    size_t* slot = (size_t*)(base + rel[i]);
+    ok = rel[i] <= size - sizeof(size_t) && *slot < size;
+    if (ok) { *slot += (uintptr_t)base; }
+  }
+  for (size_t i = 0; ok && i < h->sym_count; i++) {
+    size_t* slot = (size_t*)(base + sym[i]);
+    ok = sym[i] <= size - sizeof(size_t) && *slot < size && memchr(base + *slot, '\0', size - *slot);
+    if (ok) { *(char**)slot = lsym_intern(base + *slot); }
   }
+  int n = sizeof(lbuiltin_sigs) / sizeof(lsig);
+  for (size_t i = 0; ok && i < h->sig_count; i++) {
+    ok = sig[i] <= size - sizeof(lval);
+    lval* v = (lval*)(base + sig[i]);
+    size_t name = ok ? (size_t)v->sig : 0;
+    ok = ok && name < size && memchr(base + name, '\0', size - name);
+    lsig* found = NULL;
+    for (int j = 0; ok && j < n && !found; j++) {
+      if (strcmp(lbuiltin_sigs[j].name, base + name) == 0) { found = &lbuiltin_sigs[j]; }
+    }
+    ok = ok && found;
+    if (ok) {
+      v->sig = found;
+      v->fun = found->fun;
+    }
+  }
+  if (!ok) { munmap(base, size); errno = EINVAL; return -1; }
 
-  lval_del(a); return x;
-}
+  limage_base = base;
+  limage_end = base + size;
 
-lval* builtin_add(lenv* e, lval* a) {
-  return builtin_op(e, a, "+");
+  /* bind it all, only searching e for names through a table of them, */
+  /* since lenv_set would search its whole array for every one */
+  lenv* saved = (lenv*)(base + h->env);
+  lptrmap bound = { 0 };
+  for (int i = 0; i < e->count; i++) { *lptrmap_slot(&bound, e->syms[i]) = i + 1; }
+  e->syms = realloc(e->syms, sizeof(char*) * (e->count + saved->count));
+  e->vals = realloc(e->vals, sizeof(lval*) * (e->count + saved->count));
+  for (int i = 0; i < saved->count; i++) {
+    size_t* at = lptrmap_slot(&bound, saved->syms[i]);
+    if (*at) {
+      lenv_set(e, saved->syms[i], saved->vals[i]);
+      continue;
+    }
+    *at = e->count + 1;
+    e->syms[e->count] = saved->syms[i];
+    e->vals[e->count++] = saved->vals[i];
+  }
+  __atomic_add_fetch(&lenv_generation, 1, __ATOMIC_RELEASE);
+  free(bound.keys);
+  free(bound.offs);
+  return 0;
 }
 
-lval* builtin_sub(lenv* e, lval* a) {
-  return builtin_op(e, a, "-");
-}
+/* FORM CACHE */
 
-lval* builtin_mul(lenv* e, lval* a) {
-  return builtin_op(e, a, "*");
+/* What a file reads to, saved in a cache directory under a hash of the */
+/* file and the interpreter version, so running it again unchanged */
+/* decodes its forms instead of reading them. Only the reader's output */
+/* is kept: folding and type checks depend on what's defined as each */
+/* form is evaluated, so they're still done every run. Each entry is a */
+/* header and the forms in pre-order, one record per node: */
+/*   n <varint>               a number, zigzagged so small negatives are short */
+/*   S <varint len> <chars>   a symbol's first use, taking the next index */
+/*   s <varint index>         a symbol used before */
+/*   ( or { <varint count>    an sexpr or qexpr, then its cells */
+/*   e                        the reader's invalid number error */
+
+#define LCACHE_MAGIC "blispfc2"
+
+typedef struct {
+  char magic[8];
+  /* the source it was read from: hash names the entry, and a second, */
+  /* unrelated hash and the length must match too, so a file that only */
+  /* clashes with another on hash isn't given the other's forms */
+  uint64_t hash;
+  uint64_t check;
+  uint64_t size;
+  /* top-level forms, each an sexpr as blisp_read returns it */
+  uint64_t forms;
+} lcache_header;
+
+typedef struct {
+  lcache_header h;
+  char* path;
+  /* on a hit: the mapped entry, how far into it decoding is, the */
+  /* symbols it's defined so far, and the forms still to come */
+  char* map;
+  size_t map_size;
+  const char* p;
+  const char* end;
+  char** syms;
+  size_t nsyms;
+  size_t syms_cap;
+  long left;
+  /* on a miss: the entry being written under a temporary name, and */
+  /* the index + 1 of each symbol written so far */
+  FILE* out;
+  char* tmp;
+  lptrmap written;
+} lcache;
+
+/* Two hashes of the len bytes at p, 8 at a time, seeded with the */
+/* version so a new interpreter never picks up an old one's entries. */
+/* They share nothing but the input: different seeds, multipliers and */
+/* mixing, so bytes that collide in one are no likelier to in the other */
+void lcache_hash(const char* p, size_t len, uint64_t* hash, uint64_t* check) {
+  static const char seed[] = "blisp " BLISP_VERSION " " LCACHE_MAGIC;
+  uint64_t h = lsym_hash(seed, sizeof(seed) - 1) ^ len;
+  uint64_t k = 0x243f6a8885a308d3ULL + len;
+  for (size_t i = 0; i < sizeof(seed) - 1; i++) { k = (k + (unsigned char)seed[i]) * 0xff51afd7ed558ccdULL; }
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t x;
+    memcpy(&x, p + i, 8);
+    h = (h ^ x) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+    k = ((k + x) << 29 | (k + x) >> 35) * 0xc4ceb9fe1a85ec53ULL;
+  }
+  for (; i < len; i++) {
+    h = (h ^ (unsigned char)p[i]) * 1099511628211ULL;
+    k = (k + (unsigned char)p[i]) * 0xff51afd7ed558ccdULL;
+  }
+  *hash = h;
+  *check = k ^ k >> 33;
 }
 
-lval* builtin_div(lenv* e, lval* a) {
-  return builtin_op(e, a, "/");
+/* Look up the len bytes at src in dir, returning 1 on a hit. On a miss, */
+/* start writing an entry for them, if dir can be written to */
+int lcache_open(lcache* c, const char* dir, const char* src, size_t len) {
+  memset(c, 0, sizeof(lcache));
+  memcpy(c->h.magic, LCACHE_MAGIC, 8);
+  lcache_hash(src, len, &c->h.hash, &c->h.check);
+  c->h.size = len;
+  size_t n = strlen(dir) + 32;
+  c->path = malloc(n);
+  snprintf(c->path, n, "%s/%016llx.blc", dir, (unsigned long long)c->h.hash);
+
+  int fd = open(c->path, O_RDONLY);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(lcache_header)) {
+    c->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (c->map == MAP_FAILED) { c->map = NULL; }
+  }
+  if (fd >= 0) { close(fd); }
+  if (c->map) {
+    lcache_header* h = (lcache_header*)c->map;
+    c->map_size = st.st_size;
+    if (memcmp(h->magic, LCACHE_MAGIC, 8) == 0 && h->hash == c->h.hash
+      && h->check == c->h.check && h->size == len) {
+      madvise(c->map, c->map_size, MADV_SEQUENTIAL);
+      c->p = c->map + sizeof(lcache_header);
+      c->end = c->map + c->map_size;
+      c->left = h->forms;
+      return 1;
+    }
+    munmap(c->map, c->map_size);
+    c->map = NULL;
+  }
+
+  mkdir(dir, 0777);
+  c->tmp = malloc(n + 32);
+  snprintf(c->tmp, n + 32, "%s.%ld.tmp", c->path, (long)getpid());
+  c->out = fopen(c->tmp, "wb");
+  if (c->out && fwrite(&c->h, sizeof(lcache_header), 1, c->out) != 1) {
+    fclose(c->out);
+    unlink(c->tmp);
+    c->out = NULL;
+  }
+  return 0;
 }
 
-lval* builtin_max(lenv* e, lval* a) {
-  return builtin_op(e, a, "max");
+void lcache_put_varint(lcache* c, size_t n) {
+  while (n >= 0x80) {
+    putc((n & 0x7f) | 0x80, c->out);
+    n >>= 7;
+  }
+  putc(n, c->out);
 }
 
-lval* builtin_min(lenv* e, lval* a) {
-  return builtin_op(e, a, "min");
+void lcache_put_lval(lcache* c, lval* v) {
+  switch (v->type) {
+    case LVAL_NUM:
+      putc('n', c->out);
+      lcache_put_varint(c, ((unsigned long)v->num << 1) ^ (v->num < 0 ? ~0UL : 0));
+      break;
+    case LVAL_ERR:
+      putc('e', c->out);
+      break;
+    case LVAL_SYM: {
+      size_t* index = lptrmap_slot(&c->written, v->sym);
+      if (*index) {
+        putc('s', c->out);
+        lcache_put_varint(c, *index - 1);
+        break;
+      }
+      *index = ++c->nsyms;
+      size_t len = strlen(v->sym);
+      putc('S', c->out);
+      lcache_put_varint(c, len);
+      fwrite(v->sym, 1, len, c->out);
+      break;
+    }
+    default:
+      putc(v->type == LVAL_SEXPR ? '(' : '{', c->out);
+      lcache_put_varint(c, v->count);
+      for (int i = 0; i < v->count; i++) { lcache_put_lval(c, v->cell[i]); }
+  }
 }
 
-lval* builtin_pow(lenv* e, lval* a) {
-  return builtin_op(e, a, "^");
+/* Add the next form read to the entry being written. A form that */
+/* failed to parse, passed as NULL, means the file isn't cached */
+void lcache_put(lcache* c, lval* read) {
+  if (!c->out) { return; }
+  if (!read) {
+    fclose(c->out);
+    unlink(c->tmp);
+    c->out = NULL;
+    return;
+  }
+  lcache_put_lval(c, read);
+  c->h.forms++;
 }
 
-lval* builtin_mod(lenv* e, lval* a) {
-  return builtin_op(e, a, "%");
+int lcache_get_varint(lcache* c, size_t* n) {
+  *n = 0;
+  for (int shift = 0; c->p < c->end && shift < 64; shift += 7) {
+    unsigned char b = *c->p++;
+    *n |= (size_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) { return 1; }
+  }
+  return 0;
 }
 
-/* Register builtins with environment */
+/* The next node of the entry, or NULL if it's cut short or corrupt */
+lval* lcache_get_lval(lcache* c) {
+  if (c->p == c->end) { return NULL; }
+  char tag = *c->p++;
+  size_t n;
+  switch (tag) {
+    case 'n':
+      if (!lcache_get_varint(c, &n)) { return NULL; }
+      return lval_num((long)(n >> 1) ^ -(long)(n & 1));
+    case 'e':
+      return lval_err("invalid number");
+    case 's':
+      if (!lcache_get_varint(c, &n) || n >= c->nsyms) { return NULL; }
+      return lval_sym(c->syms[n]);
+    case 'S':
+      if (!lcache_get_varint(c, &n) || n > (size_t)(c->end - c->p)) { return NULL; }
+      if (c->nsyms == c->syms_cap) {
+        c->syms_cap = c->syms_cap ? c->syms_cap * 2 : 256;
+        c->syms = realloc(c->syms, sizeof(char*) * c->syms_cap);
+      }
+      c->syms[c->nsyms] = lsym_intern_len(c->p, n);
+      c->p += n;
+      return lval_sym(c->syms[c->nsyms++]);
+    case '(':
+    case '{': {
+      /* every cell takes at least a byte, which bounds the count */
+      if (!lcache_get_varint(c, &n) || n > (size_t)(c->end - c->p)) { return NULL; }
+      lval* v = tag == '(' ? lval_sexpr() : lval_qexpr();
+      v->cell = malloc(sizeof(lval*) * n);
+      for (size_t i = 0; i < n; i++) {
+        lval* x = lcache_get_lval(c);
+        if (!x) { lval_del(v); return NULL; }
+        v->cell[v->count++] = x;
+      }
+      return v;
+    }
+  }
+  return NULL;
+}
 
-void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
-  lval* k = lval_sym(name);
-  lval* v = lval_fun(func);
-  lenv_put(e, k, v);
-  lval_del(k); lval_del(v);
+/* The next form of a hit, or NULL after the last one. Sets left to -1 */
+/* if the entry turns out to be corrupt */
+lval* lcache_get(lcache* c) {
+  if (c->left <= 0) { return NULL; }
+  lval* read = lcache_get_lval(c);
+  if (read && read->type != LVAL_SEXPR) { lval_del(read); read = NULL; }
+  c->left = read ? c->left - 1 : -1;
+  return read;
 }
 
-void lenv_add_builtins(lenv* e) {
-  lenv_add_builtin(e, "list", builtin_list);
-  lenv_add_builtin(e, "head", builtin_head);
-  lenv_add_builtin(e, "tail", builtin_tail);
-  lenv_add_builtin(e, "join", builtin_join);
-  lenv_add_builtin(e, "len", builtin_len);
-  lenv_add_builtin(e, "eval", builtin_eval);
-  lenv_add_builtin(e, "init", builtin_init);
-  lenv_add_builtin(e, "cons", builtin_cons);
-  lenv_add_builtin(e, "+", builtin_add);
-  lenv_add_builtin(e, "add", builtin_add);
-  lenv_add_builtin(e, "-", builtin_sub);
-  lenv_add_builtin(e, "sub", builtin_sub);
-  lenv_add_builtin(e, "*", builtin_mul);
-  lenv_add_builtin(e, "mul", builtin_mul);
-  lenv_add_builtin(e, "/", builtin_div);
-  lenv_add_builtin(e, "div", builtin_div);
-  lenv_add_builtin(e, "^", builtin_pow);
-  lenv_add_builtin(e, "pow", builtin_pow);
-  lenv_add_builtin(e, "%", builtin_mod);
-  lenv_add_builtin(e, "mod", builtin_mod);
+/* Finish with c, moving a fully written entry into place. Returns 1 if */
+/* one was */
+int lcache_close(lcache* c) {
+  int saved = 0;
+  if (c->map) { munmap(c->map, c->map_size); }
+  if (c->out) {
+    /* the header again, now the forms are counted */
+    int ok = fseek(c->out, 0, SEEK_SET) == 0
+          && fwrite(&c->h, sizeof(lcache_header), 1, c->out) == 1;
+    ok = fclose(c->out) == 0 && ok;
+    saved = ok && rename(c->tmp, c->path) == 0;
+    if (!saved) { unlink(c->tmp); }
+  }
+  free(c->syms);
+  free(c->written.keys);
+  free(c->written.offs);
+  free(c->path);
+  free(c->tmp);
+  return saved;
 }
 
+/* CONTEXTS */
 
-/* LOOP */
+/* An interpreter instance: everything mutable that evaluation touches */
+/* hangs off its environment, so contexts on different threads are */
+/* independent. Values are plain malloc'd lvals, and glibc gives each */
+/* thread its own malloc arena */
+struct blisp_ctx {
+  lenv* env;
+  /* print optimizer statistics to stderr after each evaluation */
+  int debug;
+  /* read with the mpc grammar instead of lval_read_src */
+  int mpc;
+  /* directory of blisp_run's form cache, or NULL for none */
+  const char* cache;
+};
 
-int main(int argc, char** argv) {
+/* The grammar is built once and only read after that, so every context */
+/* shares it. Most input never needs it, so it's only built the first */
+/* time something falls back on mpc */
+struct {
+  mpc_parser_t* Number;
+  mpc_parser_t* Symbol;
+  mpc_parser_t* Sexpr;
+  mpc_parser_t* Qexpr;
+  mpc_parser_t* Expr;
+  mpc_parser_t* Blisp;
+} lgrammar;
+
+pthread_once_t lgrammar_once = PTHREAD_ONCE_INIT;
+
+void lgrammar_init(void) {
     /* Create Some Parsers */
-    mpc_parser_t* Number   = mpc_new("number");
-    mpc_parser_t* Symbol   = mpc_new("symbol");
-    mpc_parser_t* Sexpr    = mpc_new("sexpr");
-    mpc_parser_t* Qexpr    = mpc_new("qexpr");
-    mpc_parser_t* Expr     = mpc_new("expr");
-    mpc_parser_t* Blisp    = mpc_new("blisp");
+    lgrammar.Number   = mpc_new("number");
+    lgrammar.Symbol   = mpc_new("symbol");
+    lgrammar.Sexpr    = mpc_new("sexpr");
+    lgrammar.Qexpr    = mpc_new("qexpr");
+    lgrammar.Expr     = mpc_new("expr");
+    lgrammar.Blisp    = mpc_new("blisp");
 
     /* Define them with the following Language */
     mpca_lang(MPCA_LANG_DEFAULT,
@@ -629,39 +4397,666 @@ int main(int argc, char** argv) {
         expr     : <number> | <symbol> | <sexpr> | <qexpr> ;                     \
         blisp    : /^/ <expr>* /$/ ;                                             \
     ",
-        Number, Symbol, Sexpr, Qexpr, Expr, Blisp);
+        lgrammar.Number, lgrammar.Symbol, lgrammar.Sexpr,
+        lgrammar.Qexpr, lgrammar.Expr, lgrammar.Blisp);
+}
 
-    puts("Blisp 0.0.1");
-    puts("Press Ctrl+c to exit\n");
+blisp_ctx* blisp_ctx_new(void) {
+  blisp_ctx* ctx = malloc(sizeof(blisp_ctx));
+  ctx->env = lenv_new();
+  ctx->debug = 0;
+  ctx->mpc = 0;
+  ctx->cache = NULL;
+  lenv_add_builtins(ctx->env);
+  return ctx;
+}
 
-    /* create environment */
+void blisp_ctx_free(blisp_ctx* ctx) {
+  lenv_del(ctx->env);
+  free(ctx);
+}
+
+/* Seconds on a monotonic clock, for the -d timings */
+double lclock(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Read the len bytes at src into the sexpr of its forms, with mpc only */
+/* if the reader can't. On a parse error, print it to out and return */
+/* NULL. row and col are where src starts in the named file, for the */
+/* error's position */
+lval* blisp_read(blisp_ctx* ctx, const char* name, const char* src, size_t len,
+                 FILE* out, long row, long col) {
+  double start = lclock();
+  lval* read = ctx->mpc ? NULL : lval_read_src(src, len);
+  double parse = 0, build = lclock() - start;
+  if (!read) {
+    pthread_once(&lgrammar_once, lgrammar_init);
+    mpc_result_t r;
+    if (!mpc_nparse(name, src, len, lgrammar.Blisp, &r)) {
+      if (r.error->state.row == 0) { r.error->state.col += col; }
+      r.error->state.row += row;
+      mpc_err_print_to(r.error, out);
+      mpc_err_delete(r.error);
+      return NULL;
+    }
+    double parsed = lclock();
+    parse = parsed - start;
+    read = lval_read(r.output);
+    build = lclock() - parsed;
+    mpc_ast_delete(r.output);
+  }
+  if (ctx->debug) { fprintf(stderr, "parsed in %.3f ms, read in %.3f ms\n", parse * 1e3, build * 1e3); }
+  return read;
+}
+
+/* Optimize and evaluate what blisp_read returned, consuming it */
+lval* blisp_eval_read(blisp_ctx* ctx, lval* read) {
+  lenv* e = ctx->env;
+  lval_folded = 0;
+  lval_fold_barrier = 0;
+  lval_typed = 0;
+  lsig_skipped = 0;
+  lval* x = lval_infer(e, lval_fold(e, read));
+  if (ctx->debug) { fprintf(stderr, "folded %d nodes, typed %d call sites\n", lval_folded, lval_typed); }
+  lval* result = lval_eval(e, x);
+  if (result->type == LVAL_SEQ) { result = lseq_force(e, result); }
+  if (ctx->debug) {
+    fprintf(stderr, "memo: %ld hits, %ld misses\n", lmemo.hits, lmemo.misses);
+    fprintf(stderr, "checks: %ld skipped\n", lsig_skipped);
+  }
+  return result;
+}
+
+/* Evaluate and print what blisp_read returned, consuming it */
+/* Returns 1 if the result was an error */
+int blisp_eval_print(blisp_ctx* ctx, lval* read, FILE* out) {
+  lval* result = blisp_eval_read(ctx, read);
+  lval_fprint(out, result);
+  int err = result->type == LVAL_ERR;
+  lval_del(result);
+  return err;
+}
+
+/* Parse, evaluate and print src, returning what was printed, or the */
+/* parse error, as a malloc'd string without a trailing newline */
+char* blisp_eval(blisp_ctx* ctx, const char* src) {
+  char* buf = NULL;
+  size_t len = 0;
+  FILE* out = open_memstream(&buf, &len);
+
+  lval* read = blisp_read(ctx, "<stdin>", src, strlen(src), out, 0, 0);
+  fclose(out);
+  if (!read) {
+    if (len > 0 && buf[len-1] == '\n') { buf[len-1] = '\0'; }
+    return buf;
+  }
+  free(buf);
+
+  lval* result = blisp_eval_read(ctx, read);
+  char* printed = lval_to_string(result);
+  lval_del(result);
+  return printed;
+}
+
+/* blisp_run on a mapped file, with the pool started: each batch of */
+/* forms is read on the pool while the one before is evaluated. Forms */
+/* the reader rejects are read again in turn by blisp_read, for mpc's */
+/* error message */
+int blisp_run_batches(blisp_ctx* ctx, const char* name, lstream* s, lcache* cache,
+                      long* forms, size_t* bytes, double* loading) {
+  lindex index = { s->buf, s->end, SIZE_MAX, 0, 0, 0 };
+  lbatch batches[2] = { { 0 }, { 0 } };
+  int status = 0;
+  size_t pos = 0;
+  /* the row and column at offset at, counted up to errors as needed */
+  size_t at = 0;
+  long row = 0, col = 0;
+
+  double start = lclock();
+  lbatch_start(&batches[0], &index, &pos);
+  for (int cur = 0; batches[cur].count; cur = !cur) {
+    lbatch* b = &batches[cur];
+    lbatch_finish(b);
+    lbatch_start(&batches[!cur], &index, &pos);
+    *loading += lclock() - start;
+
+    /* the pages before this batch won't be needed again */
+    s->pos = b->forms[0].src - s->buf;
+    lstream_drop(s);
+
+    for (long k = 0; k < b->count; k++) {
+      lform* f = &b->forms[k];
+      lval* read = f->read;
+      if (!read) {
+        for (; at < (size_t)(f->src - s->buf); at++) {
+          if (s->buf[at] == '\n') { row++; col = 0; } else { col++; }
+        }
+        read = blisp_read(ctx, name, f->src, f->len, stdout, row, col);
+      }
+      if (cache) { lcache_put(cache, read); }
+      (*forms)++;
+      *bytes += f->len;
+      if (!read) { status = 1; continue; }
+      status |= blisp_eval_print(ctx, read, stdout);
+      putchar('\n');
+    }
+    start = lclock();
+  }
+
+  lbatch_free(&batches[0]);
+  lbatch_free(&batches[1]);
+  return status;
+}
+
+/* Evaluate the top-level forms of in one at a time, printing each */
+/* result, so only the form being evaluated is ever held in memory - */
+/* or with -j, the next batch of forms as well, being read meanwhile */
+/* Returns 1 if any form failed to parse or evaluated to an error */
+int blisp_run(blisp_ctx* ctx, const char* name, FILE* in) {
+  lstream s;
+  lstream_init(&s, in);
+  int status = 0;
+  /* for -d: forms read, their total size, and the time spent reading */
+  long forms = 0;
+  size_t bytes = 0;
+  double loading = 0;
+  char* form;
+  size_t len;
 
-    lenv* e = lenv_new();
-    lenv_add_builtins(e);
+  /* only a mapped file is hashed, as it's already all there to hash */
+  lcache cache;
+  int hit = 0;
+  if (ctx->cache && s.mapped) {
+    double start = lclock();
+    hit = lcache_open(&cache, ctx->cache, s.buf, s.end);
+    loading += lclock() - start;
+    if (ctx->debug) { fprintf(stderr, "cache %s: %s\n", hit ? "hit" : "miss", cache.path); }
+  }
 
+  int batched = !hit && s.mapped && !ctx->mpc && lpool.threads > 1 && lworker >= 0;
+  if (batched) {
+    status = blisp_run_batches(ctx, name, &s, ctx->cache ? &cache : NULL, &forms, &bytes, &loading);
+  } else {
     while (1) {
-        char* input = readline("blisp> ");
-        add_history(input);
-
-        /* Attempt to Parse the user Input */
-        mpc_result_t r;
-        if (mpc_parse("<stdin>", input, Blisp, &r)) {
-            /* On success, eval and print */
-            lval* result = lval_eval(e, lval_read(r.output));
-            lval_println(result);
-            lval_del(result);
-            /*mpc_ast_print(r.output);*/
-            mpc_ast_delete(r.output);
-        } else {
-            /* Otherwise print the error */
-            mpc_err_print(r.error);
-            mpc_err_delete(r.error);
+      double start = lclock();
+      lval* read;
+      if (hit) {
+        if (!(read = lcache_get(&cache))) {
+          if (cache.left == 0) { break; }
+          /* a corrupt entry: read the rest of the file from its source */
+          fprintf(stderr, "%s: corrupt cache entry, reading %s\n", cache.path, name);
+          hit = 0;
+          for (long i = 0; i < forms; i++) { lstream_form(&s, &len); }
+          continue;
+        }
+        bytes = s.end;
+      } else {
+        if (!(form = lstream_form(&s, &len))) { break; }
+        read = blisp_read(ctx, name, form, len, stdout, s.form_row, s.form_col);
+        if (ctx->cache && s.mapped) { lcache_put(&cache, read); }
+        bytes += len;
+      }
+      loading += lclock() - start;
+      forms++;
+      if (!read) { status = 1; continue; }
+      status |= blisp_eval_print(ctx, read, stdout);
+      putchar('\n');
+    }
+  }
+  if (s.err) {
+    fprintf(stderr, "%s: %s\n", name, strerror(s.err));
+    status = 1;
+  }
+  if (ctx->cache && s.mapped && lcache_close(&cache) && ctx->debug) { fputs("cache saved\n", stderr); }
+  if (ctx->debug) {
+    fprintf(stderr, "loaded %ld forms (%.1f MB, %s%s) in %.1f ms\n", forms, bytes / 1048576.0,
+            hit ? "cached" : s.mapped ? "mapped" : "read", batched ? ", read on the pool" : "",
+            loading * 1e3);
+  }
+  lstream_free(&s);
+  return status;
+}
+
+int blisp_save_image(blisp_ctx* ctx, const char* path) { return limage_save(ctx->env, path); }
+
+int blisp_load_image(blisp_ctx* ctx, const char* path) { return limage_load(ctx->env, path); }
+
+/* A blisp_eval running on its own coroutine, so it can be stopped at */
+/* any safe point and picked up again later */
+struct blisp_task {
+  blisp_ctx* ctx;
+  char* src;
+  char* output;
+  lcoro* co;
+};
+
+void blisp_task_body(void* arg) {
+  blisp_task* t = arg;
+  t->output = blisp_eval(t->ctx, t->src);
+}
+
+blisp_task* blisp_task_new(blisp_ctx* ctx, const char* src) {
+  blisp_task* t = malloc(sizeof(blisp_task));
+  t->ctx = ctx;
+  t->src = strdup(src);
+  t->output = NULL;
+  t->co = lcoro_new(blisp_task_body, t);
+  if (!t->co) { free(t->src); free(t); return NULL; }
+  return t;
+}
+
+int blisp_task_run(blisp_task* t, long fuel) {
+  if (t->co->done) { return 0; }
+  lcoro* sliced = lcoro_sliced;
+  long left = lfuel;
+  lcoro_sliced = t->co;
+  lfuel = fuel;
+  int running = lcoro_resume(t->co);
+  lcoro_sliced = sliced;
+  lfuel = left;
+  return running;
+}
+
+char* blisp_task_output(blisp_task* t) {
+  char* output = t->output;
+  t->output = NULL;
+  return output;
+}
+
+void blisp_task_free(blisp_task* t) {
+  if (!t->co->done) {
+    /* unwind it, along with any generator it was stopped inside */
+    for (lcoro* co = t->co->top; co && co != t->co; co = co->prev) { co->cancelled = 1; }
+    t->co->cancelled = 1;
+    while (blisp_task_run(t, LONG_MAX)) {}
+  }
+  lcoro_del(t->co);
+  free(t->output);
+  free(t->src);
+  free(t);
+}
+
+/* SERVER */
+
+/* blisp --serve: an epoll loop on a Unix domain socket. A request is a */
+/* 4-byte big-endian length followed by that much source, and its reply */
+/* is framed the same way around what blisp_eval returns. What the */
+/* prelude defined is shared, read-only, by every connection, each of */
+/* which gets a context with its own scope over it for def, so what */
+/* one client defines is there for its later requests but never seen */
+/* by another's. Each connection has at most one request */
+/* in flight, run as a blisp_task so a long evaluation is sliced between */
+/* events and other clients' requests rather than holding up the loop; */
+/* later requests wait in its buffer */
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* eval steps a request runs for before the loop moves on */
+#define LSERVE_FUEL 10000
+/* longest request accepted, larger ones close the connection */
+#define LSERVE_MAX (16 << 20)
+/* unsent replies a connection can have before its requests wait */
+#define LSERVE_BACKLOG (1 << 20)
+
+typedef struct lconn {
+  int fd;
+  /* the server's context, but with the connection's own scope for def */
+  blisp_ctx ctx;
+  /* requests received, in[0, in_len) */
+  char* in;
+  size_t in_len, in_cap;
+  /* replies still to send, out[out_pos, out_len) */
+  char* out;
+  size_t out_pos, out_len, out_cap;
+  /* the request being evaluated, if any */
+  blisp_task* task;
+  /* the events the connection is registered for */
+  uint32_t events;
+  /* the peer has shut down its end */
+  int eof;
+  struct lconn* prev;
+  struct lconn* next;
+} lconn;
+
+typedef struct {
+  blisp_ctx* ctx;
+  int epoll;
+  int listen;
+  lconn* conns;
+  /* connections with a task, run a slice each in turn */
+  lconn** running;
+  int nrunning, running_cap;
+} lserver;
+
+volatile sig_atomic_t lserve_stopping = 0;
+
+void lserve_stop(int sig) { lserve_stopping = 1; }
+
+void lconn_close(lserver* s, lconn* c) {
+  if (c->task) {
+    for (int i = 0; i < s->nrunning; i++) {
+      if (s->running[i] == c) { s->running[i] = s->running[--s->nrunning]; break; }
+    }
+    blisp_task_free(c->task);
+  }
+  lenv_del(c->ctx.env);
+  if (c->prev) { c->prev->next = c->next; } else { s->conns = c->next; }
+  if (c->next) { c->next->prev = c->prev; }
+  close(c->fd);
+  free(c->in);
+  free(c->out);
+  free(c);
+}
+
+/* Send what's queued, as far as the socket takes it */
+/* Returns 0 if the connection failed */
+int lconn_flush(lconn* c) {
+  while (c->out_pos < c->out_len) {
+    ssize_t n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) { continue; }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) { return 0; }
+      break;
+    }
+    c->out_pos += n;
+  }
+  if (c->out_pos == c->out_len) { c->out_pos = c->out_len = 0; }
+  return 1;
+}
+
+/* Queue output as a reply frame */
+void lconn_reply(lconn* c, const char* output) {
+  uint32_t len = strlen(output);
+  if (c->out_len + 4 + len > c->out_cap) {
+    c->out_cap = (c->out_len + 4 + len) * 2;
+    c->out = realloc(c->out, c->out_cap);
+  }
+  unsigned char* p = (unsigned char*)c->out + c->out_len;
+  p[0] = len >> 24; p[1] = len >> 16; p[2] = len >> 8; p[3] = len;
+  memcpy(p + 4, output, len);
+  c->out_len += 4 + len;
+}
+
+/* Start evaluating the next request received, if it's all there and */
+/* nothing is running. Returns 0 if the request is too long to accept */
+int lconn_next(lserver* s, lconn* c) {
+  if (c->task || c->in_len < 4 || c->out_len - c->out_pos > LSERVE_BACKLOG) { return 1; }
+  unsigned char* p = (unsigned char*)c->in;
+  uint32_t len = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+  if (len > LSERVE_MAX) { return 0; }
+  if (c->in_len < 4 + len) { return 1; }
+
+  char* src = malloc(len + 1);
+  memcpy(src, c->in + 4, len);
+  src[len] = '\0';
+  c->in_len -= 4 + len;
+  memmove(c->in, c->in + 4 + len, c->in_len);
+  c->task = blisp_task_new(&c->ctx, src);
+  free(src);
+  if (!c->task) {
+    lconn_reply(c, "Error: Out of memory");
+    return 1;
+  }
+  if (s->nrunning == s->running_cap) {
+    s->running_cap = s->running_cap ? s->running_cap * 2 : 16;
+    s->running = realloc(s->running, s->running_cap * sizeof(lconn*));
+  }
+  s->running[s->nrunning++] = c;
+  return 1;
+}
+
+/* Take in whatever the peer has sent. Returns 0 if the connection */
+/* failed, or has sent far more than it's reading back */
+int lconn_recv(lconn* c) {
+  while (!c->eof) {
+    if (c->in_len > 2 * LSERVE_MAX) { return 0; }
+    if (c->in_cap - c->in_len < 4096) {
+      c->in_cap = c->in_cap ? c->in_cap * 2 : 8192;
+      c->in = realloc(c->in, c->in_cap);
+    }
+    size_t room = c->in_cap - c->in_len;
+    ssize_t n = read(c->fd, c->in + c->in_len, room);
+    if (n < 0) {
+      if (errno == EINTR) { continue; }
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    if (n == 0) { c->eof = 1; }
+    c->in_len += n;
+    /* a short read means the socket is drained */
+    if ((size_t)n < room) { break; }
+  }
+  return 1;
+}
+
+void lserve_accept(lserver* s) {
+  while (1) {
+    int fd = accept(s->listen, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) { continue; }
+      /* EAGAIN once they're all in; out of descriptors, try later */
+      if (errno != EAGAIN && errno != EWOULDBLOCK) { perror("accept"); }
+      return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    lconn* c = calloc(1, sizeof(lconn));
+    c->fd = fd;
+    c->ctx = *s->ctx;
+    c->ctx.env = lenv_new();
+    c->ctx.env->par = s->ctx->env;
+    c->events = EPOLLIN | EPOLLRDHUP;
+    c->next = s->conns;
+    if (s->conns) { s->conns->prev = c; }
+    s->conns = c;
+    struct epoll_event ev = { .events = c->events, .data.ptr = c };
+    epoll_ctl(s->epoll, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+/* Once a connection's peer has finished sending and has every reply, */
+/* or has failed, close it. Otherwise start its next request, and watch */
+/* for input until the peer's done, and for room to send while there */
+/* are replies waiting */
+void lconn_update(lserver* s, lconn* c, int ok) {
+  if (ok && !lconn_next(s, c)) { ok = 0; }
+  if (!ok || (c->eof && !c->task && c->out_len == 0)) {
+    lconn_close(s, c);
+    return;
+  }
+  uint32_t events = (c->eof ? 0 : EPOLLIN | EPOLLRDHUP) | (c->out_len ? EPOLLOUT : 0);
+  if (events != c->events) {
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    epoll_ctl(s->epoll, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+  }
+}
+
+/* Serve ctx on a Unix domain socket at path until SIGINT or SIGTERM */
+/* Returns 0, or -1 with errno set if the socket couldn't be set up */
+int lserve(blisp_ctx* ctx, const char* path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) { errno = ENAMETOOLONG; return -1; }
+  strcpy(addr.sun_path, path);
+
+  /* a socket left behind by a server that's gone is replaced, but */
+  /* nothing else is */
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int live = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    if (probe >= 0) { close(probe); }
+    if (live) { errno = EADDRINUSE; return -1; }
+    unlink(path);
+  }
+
+  lserver s = { ctx, -1, -1, NULL, NULL, 0, 0 };
+  s.listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (s.listen < 0) { return -1; }
+  if (bind(s.listen, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(s.listen, SOMAXCONN) != 0 ||
+      (s.epoll = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    int err = errno;
+    close(s.listen);
+    errno = err;
+    return -1;
+  }
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+  epoll_ctl(s.epoll, EPOLL_CTL_ADD, s.listen, &ev);
+
+  /* no SA_RESTART, so a signal wakes epoll_wait */
+  struct sigaction sa = { .sa_handler = lserve_stop };
+  sigemptyset(&sa.sa_mask);
+  struct sigaction old_int, old_term;
+  sigaction(SIGINT, &sa, &old_int);
+  sigaction(SIGTERM, &sa, &old_term);
+
+  /* whatever the prelude printed goes out before the wait for clients */
+  fflush(stdout);
+  struct epoll_event events[64];
+  lserve_stopping = 0;
+  /* the prelude's scope is under every connection's from here on */
+  ctx->env->shared = 1;
+  while (!lserve_stopping) {
+    /* only block when there's nothing to evaluate */
+    int n = epoll_wait(s.epoll, events, 64, s.nrunning ? 0 : -1);
+    if (n < 0 && errno != EINTR) { perror("epoll_wait"); break; }
+    for (int i = 0; i < n; i++) {
+      lconn* c = events[i].data.ptr;
+      if (!c) { lserve_accept(&s); continue; }
+      int ok = !(events[i].events & EPOLLERR);
+      if (ok && events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) { ok = lconn_recv(c); }
+      if (ok && events[i].events & EPOLLOUT) { ok = lconn_flush(c); }
+      lconn_update(&s, c, ok);
+    }
+
+    /* a slice of each running request, replying to those that finish */
+    for (int i = 0; i < s.nrunning;) {
+      lconn* c = s.running[i];
+      if (blisp_task_run(c->task, LSERVE_FUEL)) { i++; continue; }
+      char* output = blisp_task_output(c->task);
+      lconn_reply(c, output);
+      free(output);
+      blisp_task_free(c->task);
+      c->task = NULL;
+      s.running[i] = s.running[--s.nrunning];
+      lconn_update(&s, c, lconn_flush(c));
+    }
+  }
+
+  /* closing the connections cancels anything still running */
+  while (s.conns) { lconn_close(&s, s.conns); }
+  ctx->env->shared = 0;
+  sigaction(SIGINT, &old_int, NULL);
+  sigaction(SIGTERM, &old_term, NULL);
+  close(s.epoll);
+  close(s.listen);
+  unlink(path);
+  free(s.running);
+  return 0;
+}
+
+/* LOOP */
+
+#ifndef BLISP_NO_MAIN
+int main(int argc, char** argv) {
+    /* -d prints optimizer statistics after each evaluation */
+    /* -j N evaluates independent args on N threads */
+    /* -m reads input with the mpc grammar rather than lval_read_src */
+    /* run FILE, or - for stdin, evaluates each top-level form in turn */
+    /* instead of starting the REPL */
+    /* --cache DIR keeps what each file run reads to in DIR, and reads */
+    /* it from there next time if the file hasn't changed */
+    /* --load-image FILE starts from the definitions saved in FILE, and */
+    /* --save-image FILE saves them there once the script or REPL is done */
+    /* --serve SOCKET serves requests on a Unix domain socket instead of */
+    /* the REPL, after running FILE, if given, as their prelude */
+    int debug = 0;
+    int mpc = 0;
+    int threads = 1;
+    char* script = NULL;
+    char* load_image = NULL;
+    char* save_image = NULL;
+    char* cache = NULL;
+    char* serve = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--load-image") == 0 && i + 1 < argc) { load_image = argv[++i]; continue; }
+        if (strcmp(argv[i], "--save-image") == 0 && i + 1 < argc) { save_image = argv[++i]; continue; }
+        if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) { cache = argv[++i]; continue; }
+        if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) { serve = argv[++i]; continue; }
+        if (strcmp(argv[i], "run") == 0 && i + 1 < argc) { script = argv[++i]; }
+        if (strcmp(argv[i], "-") == 0) { script = argv[i]; }
+        if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0) { debug = 1; }
+        if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--mpc") == 0) { mpc = 1; }
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) { threads = atoi(argv[++i]); }
+    }
+    if (threads > 1) { lpool_start(threads); }
+
+    /* create environment */
+    blisp_ctx* ctx = blisp_ctx_new();
+    ctx->debug = debug;
+    ctx->mpc = mpc;
+    ctx->cache = cache;
+
+    int status = 0;
+    if (load_image && blisp_load_image(ctx, load_image) != 0) {
+        fprintf(stderr, "%s: %s\n", load_image, strerror(errno));
+        status = 1;
+    } else {
+        if (script) {
+            int is_stdin = strcmp(script, "-") == 0;
+            FILE* in = is_stdin ? stdin : fopen(script, "r");
+            if (in) {
+                status = blisp_run(ctx, is_stdin ? "<stdin>" : script, in);
+                if (!is_stdin) { fclose(in); }
+            } else {
+                perror(script);
+                status = 1;
+            }
+        }
+        if (serve) {
+            /* don't serve with half a prelude */
+            if (status) {
+                fprintf(stderr, "%s: prelude failed, not serving\n", serve);
+            } else if (lserve(ctx, serve) != 0) {
+                fprintf(stderr, "%s: %s\n", serve, strerror(errno));
+                status = 1;
+            }
+        } else if (!script) {
+            puts("Blisp " BLISP_VERSION);
+            puts("Press Ctrl+c to exit\n");
+
+            while (1) {
+                char* input = readline("blisp> ");
+                if (!input) { break; }
+                add_history(input);
+
+                char* output = blisp_eval(ctx, input);
+                puts(output);
+                free(output);
+                free(input);
+            }
+        }
+
+        if (save_image && blisp_save_image(ctx, save_image) != 0) {
+            fprintf(stderr, "%s: %s\n", save_image, strerror(errno));
+            status = 1;
         }
-        free(input);
     }
     /* Cleanup environment */
-    lenv_del(e);
-    /* Undefine and Delete our Parsers */
-    mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Blisp);
-    return 0;
-}
\ No newline at end of file
+    lpool_stop();
+    blisp_ctx_free(ctx);
+    /* Undefine and Delete our Parsers, if they were ever needed */
+    if (lgrammar.Blisp) {
+        mpc_cleanup(6, lgrammar.Number, lgrammar.Symbol, lgrammar.Sexpr,
+                    lgrammar.Qexpr, lgrammar.Expr, lgrammar.Blisp);
+    }
+    return status;
+}
+#endif
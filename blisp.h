@@ -0,0 +1,37 @@
+#ifndef blisp_h
+#define blisp_h
+
+/* Embedding API */
+/* Build blisp.c with -DBLISP_NO_MAIN to link it into another program */
+
+/* An interpreter with its own environment. Contexts may be used from */
+/* different threads at once, but each from one thread at a time */
+typedef struct blisp_ctx blisp_ctx;
+
+blisp_ctx* blisp_ctx_new(void);
+void blisp_ctx_free(blisp_ctx* ctx);
+
+/* Evaluate src as one line of REPL input, returning the printed result */
+/* (or parse error) as a string the caller frees */
+char* blisp_eval(blisp_ctx* ctx, const char* src);
+
+/* Save ctx's definitions to an image file, or bind everything saved in */
+/* one, mapping it in rather than evaluating the source it came from */
+/* again. Both return 0, or -1 with errno set. A process can load only */
+/* one image, which then stays mapped until it exits */
+int blisp_save_image(blisp_ctx* ctx, const char* path);
+int blisp_load_image(blisp_ctx* ctx, const char* path);
+
+/* A time-sliced blisp_eval, for sharing one thread between evaluations */
+/* Each run goes on for at most about fuel eval steps before returning */
+typedef struct blisp_task blisp_task;
+
+blisp_task* blisp_task_new(blisp_ctx* ctx, const char* src);
+/* Returns 1 if the task still has more to do, 0 once it's finished */
+int blisp_task_run(blisp_task* t, long fuel);
+/* The finished task's output, as blisp_eval returns it, or NULL */
+char* blisp_task_output(blisp_task* t);
+/* Frees the task, cancelling it first if it hasn't finished */
+void blisp_task_free(blisp_task* t);
+
+#endif
@@ -80,6 +80,7 @@ typedef struct {
   mpc_state_t state;
   
   char *string;
+  long length;
   char *buffer;
   FILE *file;
   
@@ -108,7 +109,8 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
+  i->length = strlen(string);
+  i->string = malloc(i->length + 1);
   strcpy(i->string, string);
   i->buffer = NULL;
   i->file = NULL;
@@ -140,6 +142,7 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->string = malloc(length + 1);
   strncpy(i->string, string, length);
   i->string[length] = '\0';
+  i->length = strlen(i->string);
   i->buffer = NULL;
   i->file = NULL;
   
@@ -169,6 +172,7 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = pipe;
   
@@ -197,6 +201,7 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = file;
   
@@ -362,7 +367,7 @@ static char mpc_input_buffer_get(mpc_input_t *i) {
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos == i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
   if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
   return 0;
@@ -931,6 +936,8 @@ struct mpc_parser_t {
   mpc_pdata_t data;
   char type;
   char retained;
+  /* position among the parsers given to mpca_lang, tagged onto ASTs */
+  int id;
 };
 
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
@@ -1452,6 +1459,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
   p->retained = a->retained;
   p->type = a->type;
   p->data = a->data;
+  p->id = a->id;
   
   if (a->name) {
     p->name = malloc(strlen(a->name)+1);
@@ -2823,6 +2831,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
   
   a->children_num = 0;
   a->children = NULL;
+  a->rule = 0;
   return a;
   
 }
@@ -2889,6 +2898,12 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   return a;
 }
 
+mpc_ast_t *mpc_ast_add_rule(mpc_ast_t *a, mpc_parser_t *p) {
+  if (a == NULL) { return a; }
+  if (a->rule == 0) { a->rule = p->id; }
+  return mpc_ast_add_tag(a, p->name);
+}
+
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
   a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
@@ -3131,6 +3146,7 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
     if        (as[i] && as[i]->children_num == 0) {
       mpc_ast_add_child(r, as[i]);
     } else if (as[i] && as[i]->children_num == 1) {
+      if (as[i]->children[0]->rule == 0) { as[i]->children[0]->rule = as[i]->rule; }
       mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
       mpc_ast_delete_no_children(as[i]);
     } else if (as[i] && as[i]->children_num >= 2) {
@@ -3176,6 +3192,10 @@ mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
   return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
 }
 
+static mpc_parser_t *mpca_add_rule(mpc_parser_t *a) {
+  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_rule, a);
+}
+
 mpc_parser_t *mpca_root(mpc_parser_t *a) {
   return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
 }
@@ -3365,6 +3385,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
       if (st->parsers[st->parsers_num-1] == NULL) {
         return mpc_failf("No Parser in position %i! Only supplied %i Parsers!", i, st->parsers_num);
       }
+      st->parsers[st->parsers_num-1]->id = st->parsers_num;
     }
     
     return st->parsers[st->parsers_num-1];
@@ -3389,6 +3410,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
       st->parsers[st->parsers_num-1] = p;
       
       if (p == NULL || p->name == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
+      p->id = st->parsers_num;
       if (p->name && strcmp(p->name, x) == 0) { return p; }
       
     }
@@ -3404,7 +3426,7 @@ static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
   free(x);
 
   if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
+    return mpca_state(mpca_root(mpca_add_rule(p)));
   } else {
     return mpca_state(mpca_root(p));
   }